@@ -0,0 +1,632 @@
+/* compress.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compressed (gzip or zstd) image files.
+ *
+ * Images are compressed in independent chunks using multiple threads:
+ * with gzip each chunk is a separate gzip member (with compressed and
+ * uncompressed size of the member stored in an extra field), and with zstd
+ * each chunk is a separate frame (with content size in the frame header).
+ * Such files are decompressed in parallel as well, while files created by
+ * other tools are decompressed serially. Standard gzip and zstd tools can
+ * decompress the files normally.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+#include "littlefs-toy.h"
+
+#define COMPRESS_CHUNK_SIZE (1024 * 1024)
+#define COMPRESS_MAX_THREADS 8
+#define COMPRESS_MAX_IO (1024 * 1024 * 1024)
+#define COMPRESS_ZSTD_LEVEL 3
+
+#define GZIP_HEADER_SIZE 24 /* with the extra field */
+#define GZIP_TRAILER_SIZE 8
+#define ZSTD_MAGIC 0xfd2fb528
+
+
+struct compress_job {
+	const uint8_t *src;
+	size_t src_len;
+	uint8_t *dst;
+	size_t dst_len;
+	size_t offset;
+	uint32_t crc;
+	int res;
+};
+
+typedef int (*compress_job_func)(struct compress_job *job);
+
+struct compress_pool {
+	struct compress_job *jobs;
+	size_t count;
+	size_t next;
+	compress_job_func func;
+	pthread_mutex_t mutex;
+};
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+int compress_detect(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+		return COMPRESS_GZIP;
+	if (len >= 4 && get_u32(p) == ZSTD_MAGIC)
+		return COMPRESS_ZSTD;
+
+	return COMPRESS_NONE;
+}
+
+
+int compress_detect_name(const char *filename)
+{
+	size_t len;
+
+	if (!filename)
+		return COMPRESS_NONE;
+	len = strlen(filename);
+	if (len > 3 && !strcmp(filename + len - 3, ".gz"))
+		return COMPRESS_GZIP;
+	if (len > 4 && !strcmp(filename + len - 4, ".zst"))
+		return COMPRESS_ZSTD;
+
+	return COMPRESS_NONE;
+}
+
+
+int compress_detect_file(const char *filename)
+{
+	uint8_t buf[4];
+	ssize_t len;
+	int fd;
+
+	if ((fd = open_file(filename, true)) < 0)
+		return COMPRESS_NONE;
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	return (len > 0 ? compress_detect(buf, len) : COMPRESS_NONE);
+}
+
+
+const char* compress_name(int type)
+{
+	if (type == COMPRESS_GZIP)
+		return "gzip";
+	if (type == COMPRESS_ZSTD)
+		return "zstd";
+
+	return "none";
+}
+
+
+int compress_supported(int type)
+{
+#ifdef HAVE_ZLIB
+	if (type == COMPRESS_GZIP)
+		return 1;
+#endif
+#ifdef HAVE_ZSTD
+	if (type == COMPRESS_ZSTD)
+		return 1;
+#endif
+	return (type == COMPRESS_NONE);
+}
+
+
+static void* pool_thread(void *arg)
+{
+	struct compress_pool *pool = (struct compress_pool*)arg;
+	struct compress_job *job;
+
+	while (1) {
+		pthread_mutex_lock(&pool->mutex);
+		job = (pool->next < pool->count ? &pool->jobs[pool->next++] : NULL);
+		pthread_mutex_unlock(&pool->mutex);
+		if (!job)
+			break;
+		job->res = pool->func(job);
+	}
+
+	return NULL;
+}
+
+
+static int run_jobs(struct compress_job *jobs, size_t count, compress_job_func func)
+{
+	struct compress_pool pool;
+	pthread_t threads[COMPRESS_MAX_THREADS];
+	int thread_count = 2;
+	int i;
+
+
+	memset(&pool, 0, sizeof(pool));
+	pool.jobs = jobs;
+	pool.count = count;
+	pool.func = func;
+	pthread_mutex_init(&pool.mutex, NULL);
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((thread_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		thread_count = 1;
+	if (thread_count > COMPRESS_MAX_THREADS)
+		thread_count = COMPRESS_MAX_THREADS;
+#endif
+	/* Calling thread processes jobs as well */
+	if ((size_t)thread_count > count)
+		thread_count = count;
+	for (i = 0; i < thread_count - 1; i++) {
+		if (pthread_create(&threads[i], NULL, pool_thread, &pool))
+			break;
+	}
+	thread_count = i;
+	pool_thread(&pool);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.mutex);
+
+	for (size_t j = 0; j < count; j++) {
+		if (jobs[j].res)
+			return jobs[j].res;
+	}
+
+	return 0;
+}
+
+
+#ifdef HAVE_ZLIB
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+
+static int gzip_compress_job(struct compress_job *job)
+{
+	z_stream zs;
+	size_t bound;
+	uint8_t *p;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+				Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+	bound = deflateBound(&zs, job->src_len) + GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
+	if (!(job->dst = malloc(bound))) {
+		deflateEnd(&zs);
+		return -2;
+	}
+	zs.next_in = (Bytef*)job->src;
+	zs.avail_in = job->src_len;
+	zs.next_out = job->dst + GZIP_HEADER_SIZE;
+	zs.avail_out = bound - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		return -3;
+	}
+	job->dst_len = GZIP_HEADER_SIZE + zs.total_out + GZIP_TRAILER_SIZE;
+	deflateEnd(&zs);
+
+	/* Member header with "LF" extra field: member size and uncompressed size */
+	p = job->dst;
+	memset(p, 0, GZIP_HEADER_SIZE);
+	p[0] = 0x1f;
+	p[1] = 0x8b;
+	p[2] = 8;    /* deflate */
+	p[3] = 0x04; /* FEXTRA */
+	p[9] = 255;  /* unknown OS */
+	p[10] = 12;  /* XLEN */
+	p[12] = 'L';
+	p[13] = 'F';
+	p[14] = 8;
+	put_u32(p + 16, job->dst_len);
+	put_u32(p + 20, job->src_len);
+
+	p = job->dst + job->dst_len - GZIP_TRAILER_SIZE;
+	put_u32(p, crc32(0, job->src, job->src_len));
+	put_u32(p + 4, job->src_len);
+
+	return 0;
+}
+
+
+static int gzip_decompress_job(struct compress_job *job)
+{
+	z_stream zs;
+	int res;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -15) != Z_OK)
+		return -1;
+	zs.next_in = (Bytef*)job->src;
+	zs.avail_in = job->src_len;
+	zs.next_out = job->dst;
+	zs.avail_out = job->dst_len;
+	res = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (res != Z_STREAM_END || zs.total_out != job->dst_len)
+		return -2;
+	if (crc32(0, job->dst, job->dst_len) != job->crc)
+		return -3;
+
+	return 0;
+}
+
+
+/* Find gzip members (written by compress_write), returns 1 for other files */
+static int gzip_members(const uint8_t *src, size_t len, struct compress_job **jobs,
+		size_t *count, size_t *total)
+{
+	size_t pos = 0, alloc = 0;
+
+	while (pos < len) {
+		const uint8_t *p = src + pos;
+		struct compress_job *job;
+		uint32_t size;
+
+		if (len - pos < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE
+			|| p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || p[3] != 0x04
+			|| p[10] != 12 || p[11] != 0 || p[12] != 'L' || p[13] != 'F'
+			|| p[14] != 8 || p[15] != 0)
+			return 1;
+		size = get_u32(p + 16);
+		if (size < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE || size > len - pos
+			|| get_u32(p + size - 4) != get_u32(p + 20))
+			return 1;
+
+		if (*count >= alloc) {
+			alloc = (alloc ? alloc * 2 : 64);
+			if (!(job = realloc(*jobs, alloc * sizeof(struct compress_job))))
+				return -1;
+			*jobs = job;
+		}
+		job = &(*jobs)[(*count)++];
+		memset(job, 0, sizeof(struct compress_job));
+		job->src = p + GZIP_HEADER_SIZE;
+		job->src_len = size - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE;
+		job->dst_len = get_u32(p + 20);
+		job->crc = get_u32(p + size - 8);
+		job->offset = *total;
+		*total += job->dst_len;
+		pos += size;
+	}
+
+	return 0;
+}
+
+
+static int gzip_decompress_serial(const uint8_t *src, size_t len, uint8_t **buf,
+		size_t *size)
+{
+	z_stream zs;
+	size_t alloc, out = 0, in_pos = 0;
+	uint8_t *p, *tmp;
+	int res;
+
+	/* Trailer of the last member has (lower 32 bits of) uncompressed size */
+	alloc = (len >= 4 ? get_u32(src + len - 4) : 0);
+	if (alloc < COMPRESS_CHUNK_SIZE)
+		alloc = COMPRESS_CHUNK_SIZE;
+	if (!(p = malloc(alloc)))
+		return -1;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+		free(p);
+		return -2;
+	}
+
+	while (1) {
+		size_t in_len, out_len;
+
+		if (zs.avail_in == 0 && in_pos < len) {
+			in_len = (len - in_pos > COMPRESS_MAX_IO ? COMPRESS_MAX_IO : len - in_pos);
+			zs.next_in = (Bytef*)src + in_pos;
+			zs.avail_in = in_len;
+			in_pos += in_len;
+		}
+		if (out == alloc) {
+			if (!(tmp = realloc(p, alloc * 2))) {
+				res = Z_MEM_ERROR;
+				break;
+			}
+			p = tmp;
+			alloc *= 2;
+		}
+		out_len = (alloc - out > COMPRESS_MAX_IO ? COMPRESS_MAX_IO : alloc - out);
+		zs.next_out = p + out;
+		zs.avail_out = out_len;
+		res = inflate(&zs, Z_NO_FLUSH);
+		out += out_len - zs.avail_out;
+
+		if (res == Z_STREAM_END) {
+			size_t next = in_pos - zs.avail_in;
+
+			/* Continue with the next member (if any) */
+			if (len - next >= 2 && src[next] == 0x1f && src[next + 1] == 0x8b) {
+				if ((res = inflateReset(&zs)) != Z_OK)
+					break;
+				continue;
+			}
+			res = Z_OK;
+			break;
+		}
+		if (res == Z_BUF_ERROR && zs.avail_in == 0 && in_pos == len) {
+			/* Truncated file */
+			res = Z_DATA_ERROR;
+			break;
+		}
+		if (res != Z_OK && res != Z_BUF_ERROR)
+			break;
+	}
+	inflateEnd(&zs);
+
+	if (res != Z_OK) {
+		free(p);
+		return -3;
+	}
+	*buf = p;
+	*size = out;
+
+	return 0;
+}
+#endif /* HAVE_ZLIB */
+
+
+#ifdef HAVE_ZSTD
+static int zstd_compress_job(struct compress_job *job)
+{
+	size_t bound = ZSTD_compressBound(job->src_len);
+	size_t res;
+
+	if (!(job->dst = malloc(bound)))
+		return -2;
+	res = ZSTD_compress(job->dst, bound, job->src, job->src_len, COMPRESS_ZSTD_LEVEL);
+	if (ZSTD_isError(res))
+		return -3;
+	job->dst_len = res;
+
+	return 0;
+}
+
+
+static int zstd_decompress_job(struct compress_job *job)
+{
+	size_t res = ZSTD_decompress(job->dst, job->dst_len, job->src, job->src_len);
+
+	if (ZSTD_isError(res) || res != job->dst_len)
+		return -2;
+
+	return 0;
+}
+
+
+/* Find zstd frames with known content size, returns 1 for other files */
+static int zstd_frames(const uint8_t *src, size_t len, struct compress_job **jobs,
+		size_t *count, size_t *total)
+{
+	size_t pos = 0, alloc = 0;
+
+	while (pos < len) {
+		size_t size = ZSTD_findFrameCompressedSize(src + pos, len - pos);
+		unsigned long long content = ZSTD_getFrameContentSize(src + pos, len - pos);
+		struct compress_job *job;
+
+		if (ZSTD_isError(size) || content == ZSTD_CONTENTSIZE_UNKNOWN
+			|| content == ZSTD_CONTENTSIZE_ERROR || content > SIZE_MAX - *total)
+			return 1;
+
+		if (*count >= alloc) {
+			alloc = (alloc ? alloc * 2 : 64);
+			if (!(job = realloc(*jobs, alloc * sizeof(struct compress_job))))
+				return -1;
+			*jobs = job;
+		}
+		job = &(*jobs)[(*count)++];
+		memset(job, 0, sizeof(struct compress_job));
+		job->src = src + pos;
+		job->src_len = size;
+		job->dst_len = content;
+		job->offset = *total;
+		*total += content;
+		pos += size;
+	}
+
+	return 0;
+}
+
+
+static int zstd_decompress_serial(const uint8_t *src, size_t len, uint8_t **buf,
+		size_t *size)
+{
+	ZSTD_DStream *ds;
+	ZSTD_inBuffer in = { src, len, 0 };
+	size_t alloc = COMPRESS_CHUNK_SIZE * 16;
+	size_t out = 0, res = 0;
+	uint8_t *p, *tmp;
+
+	if (!(p = malloc(alloc)))
+		return -1;
+	if (!(ds = ZSTD_createDStream())) {
+		free(p);
+		return -2;
+	}
+	ZSTD_initDStream(ds);
+
+	/* Decoder may hold buffered output after all input has been consumed,
+	 * so keep going until frame is complete (or no more progress) */
+	for (;;) {
+		ZSTD_outBuffer o;
+
+		if (out == alloc) {
+			if (!(tmp = realloc(p, alloc * 2))) {
+				res = -1;
+				break;
+			}
+			p = tmp;
+			alloc *= 2;
+		}
+		o.dst = p + out;
+		o.size = alloc - out;
+		o.pos = 0;
+		res = ZSTD_decompressStream(ds, &o, &in);
+		out += o.pos;
+		if (ZSTD_isError(res))
+			break;
+		if (in.pos == in.size && (res == 0 || o.pos < o.size))
+			break;
+	}
+	ZSTD_freeDStream(ds);
+
+	/* Non-zero result means that frame is not complete */
+	if (res != 0) {
+		free(p);
+		return -3;
+	}
+	*buf = p;
+	*size = out;
+
+	return 0;
+}
+#endif /* HAVE_ZSTD */
+
+
+/* Decompress (whole) compressed file into a new buffer */
+int decompress_buf(int type, const void *src, size_t len, void **buf, size_t *size)
+{
+	struct compress_job *jobs = NULL;
+	compress_job_func func = NULL;
+	size_t count = 0, total = 0;
+	uint8_t *out = NULL;
+	int res = -10;
+
+
+	if (!src || !buf || !size)
+		return -1;
+
+#ifdef HAVE_ZLIB
+	if (type == COMPRESS_GZIP) {
+		if ((res = gzip_members(src, len, &jobs, &count, &total)) > 0)
+			res = gzip_decompress_serial(src, len, &out, &total);
+		func = gzip_decompress_job;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (type == COMPRESS_ZSTD) {
+		if ((res = zstd_frames(src, len, &jobs, &count, &total)) > 0)
+			res = zstd_decompress_serial(src, len, &out, &total);
+		func = zstd_decompress_job;
+	}
+#endif
+
+	/* Decompress independent chunks in parallel */
+	if (res == 0 && !out) {
+		if (!(out = malloc(total > 0 ? total : 1)))
+			res = -2;
+		for (size_t i = 0; i < count && res == 0; i++)
+			jobs[i].dst = out + jobs[i].offset;
+		if (res == 0 && (res = run_jobs(jobs, count, func))) {
+			free(out);
+			out = NULL;
+		}
+	}
+	free(jobs);
+
+	if (res == 0) {
+		*buf = out;
+		*size = total;
+	}
+
+	return res;
+}
+
+
+/* Write buffer compressed into a file */
+int compress_write(int fd, int type, const void *buf, size_t size)
+{
+	struct compress_job *jobs;
+	compress_job_func func = NULL;
+	size_t count = (size + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+	int res;
+
+
+	if (fd < 0 || !buf)
+		return -1;
+#ifdef HAVE_ZLIB
+	if (type == COMPRESS_GZIP)
+		func = gzip_compress_job;
+#endif
+#ifdef HAVE_ZSTD
+	if (type == COMPRESS_ZSTD)
+		func = zstd_compress_job;
+#endif
+	if (!func)
+		return -10;
+
+	if (!(jobs = calloc(count > 0 ? count : 1, sizeof(struct compress_job))))
+		return -2;
+	for (size_t i = 0; i < count; i++) {
+		jobs[i].src = (const uint8_t*)buf + i * COMPRESS_CHUNK_SIZE;
+		jobs[i].src_len = (size - i * COMPRESS_CHUNK_SIZE > COMPRESS_CHUNK_SIZE ?
+				COMPRESS_CHUNK_SIZE : size - i * COMPRESS_CHUNK_SIZE);
+	}
+
+	/* Compress chunks in parallel, and write them out in order */
+	res = run_jobs(jobs, count, func);
+	for (size_t i = 0; i < count; i++) {
+		if (res == 0 && write_file(fd, -1, jobs[i].dst, jobs[i].dst_len))
+			res = -3;
+		free(jobs[i].dst);
+	}
+	free(jobs);
+
+	return res;
+}
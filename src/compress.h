@@ -0,0 +1,51 @@
+/* compress.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_ZSTD 2
+
+
+int compress_detect(const void *buf, size_t len);
+int compress_detect_name(const char *filename);
+int compress_detect_file(const char *filename);
+const char* compress_name(int type);
+int compress_supported(int type);
+int decompress_buf(int type, const void *src, size_t len, void **buf, size_t *size);
+int compress_write(int fd, int type, const void *buf, size_t size);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _COMPRESS_H_ */
@@ -0,0 +1,368 @@
+/* container.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Read flash contents from UF2 and Intel HEX firmware files.
+ *
+ * Data records are indexed (by address) instead of expanding them into
+ * a flat image, so that only the range of flash actually needed gets
+ * materialized. Records are assumed not to overlap.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+
+#include "container.h"
+#include "littlefs-toy.h"
+
+#define UF2_MAGIC_START0 0x0a324655
+#define UF2_MAGIC_START1 0x9e5d5157
+#define UF2_MAGIC_END    0x0ab16f30
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001
+#define UF2_FLAG_FAMILY_ID 0x00002000
+#define UF2_BLOCK_SIZE   512
+#define UF2_MAX_PAYLOAD  476
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static int hex_byte(const char *s)
+{
+	int hi, lo;
+
+	if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+		return -1;
+	hi = (isdigit((unsigned char)s[0]) ? s[0] - '0' : (toupper(s[0]) - 'A' + 10));
+	lo = (isdigit((unsigned char)s[1]) ? s[1] - '0' : (toupper(s[1]) - 'A' + 10));
+
+	return (hi << 4) | lo;
+}
+
+
+static int cmp_record(const void *a, const void *b)
+{
+	const struct container_record *ra = (const struct container_record*)a;
+	const struct container_record *rb = (const struct container_record*)b;
+
+	if (ra->addr < rb->addr)
+		return -1;
+	return (ra->addr > rb->addr ? 1 : 0);
+}
+
+
+int container_detect(const char *filename)
+{
+	uint8_t buf[16];
+	ssize_t len;
+	int fd, i;
+
+
+	if (!filename)
+		return -1;
+	if ((fd = open_file(filename, true)) < 0)
+		return -2;
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	if (len >= 8 && get_u32(buf) == UF2_MAGIC_START0
+		&& get_u32(buf + 4) == UF2_MAGIC_START1)
+		return CONTAINER_UF2;
+
+	/* Intel HEX: starts with a record ":LLAAAATT..." */
+	if (len >= 11 && buf[0] == ':') {
+		for (i = 1; i < 11; i++) {
+			if (!isxdigit(buf[i]))
+				break;
+		}
+		if (i == 11)
+			return CONTAINER_IHEX;
+	}
+
+	return CONTAINER_NONE;
+}
+
+
+static int load_uf2(struct container *c, size_t size)
+{
+	struct container_record *r;
+
+	if (size % UF2_BLOCK_SIZE != 0)
+		return -10;
+	if (!(c->records = malloc((size / UF2_BLOCK_SIZE) * sizeof(*r)))
+		|| !(c->extra = malloc((size / UF2_BLOCK_SIZE) * sizeof(*r))))
+		return -11;
+
+	for (size_t o = 0; o < size; o += UF2_BLOCK_SIZE) {
+		const uint8_t *blk = c->buf + o;
+		uint32_t flags = get_u32(blk + 8);
+		uint32_t len = get_u32(blk + 16);
+
+		if (get_u32(blk) != UF2_MAGIC_START0 || get_u32(blk + 4) != UF2_MAGIC_START1
+			|| get_u32(blk + UF2_BLOCK_SIZE - 4) != UF2_MAGIC_END)
+			return -12;
+		if (len > UF2_MAX_PAYLOAD || (uint64_t)get_u32(blk + 12) + len > ((uint64_t)1 << 32))
+			return -13;
+
+		/* Blocks not for main flash are only kept (to be written back as is) */
+		if (flags & UF2_FLAG_NOT_MAIN_FLASH) {
+			r = &c->extra[c->extra_count++];
+		} else {
+			if ((flags & UF2_FLAG_FAMILY_ID) && c->family_id == 0)
+				c->family_id = get_u32(blk + 28);
+			r = &c->records[c->count++];
+		}
+		r->addr = get_u32(blk + 12);
+		r->len = len;
+		r->data = blk + 32;
+		r->block = blk;
+		r->flags = flags;
+		r->family_id = get_u32(blk + 28);
+	}
+
+	return 0;
+}
+
+
+static int load_ihex(struct container *c, size_t size)
+{
+	const char *s = (const char*)c->buf;
+	const char *end = s + size;
+	struct container_record *r = NULL;
+	uint8_t *data, *p;
+	uint32_t base = 0;
+	size_t alloc = 0;
+	int lineno = 0;
+
+	/* Decoded data is (always) less than half of the text */
+	if (!(data = malloc(size / 2 + 1)))
+		return -11;
+	p = data;
+
+	while (s < end) {
+		uint8_t rec[255 + 5];
+		const char *eol, *next;
+		int len, v, sum = 0;
+
+		if (!(eol = memchr(s, '\n', end - s)))
+			eol = end;
+		next = eol + 1;
+		lineno++;
+		while (s < eol && isspace((unsigned char)*s))
+			s++;
+		while (eol > s && isspace((unsigned char)eol[-1]))
+			eol--;
+		if (eol == s) {
+			s = next;
+			continue;
+		}
+
+		len = (eol - s - 1) / 2;
+		if (*s != ':' || len < 5 || len > (int)sizeof(rec) || (eol - s - 1) % 2 != 0)
+			len = -1;
+		for (int i = 0; i < len; i++) {
+			if ((v = hex_byte(s + 1 + i * 2)) < 0) {
+				len = -1;
+				break;
+			}
+			rec[i] = v;
+			sum += v;
+		}
+		if (len < 0 || (sum & 0xff) != 0 || len != rec[0] + 5) {
+			warn("line %d: invalid Intel HEX record", lineno);
+			free(data);
+			return -12;
+		}
+
+		uint32_t addr = base + ((rec[1] << 8) | rec[2]);
+		uint8_t type = rec[3];
+
+		if (type == 0x00 && rec[0] > 0) {
+			if (c->count > 0 && r->addr + r->len == addr && r->data + r->len == p) {
+				/* Merge with previous record */
+				r->len += rec[0];
+			} else {
+				if (c->count >= alloc) {
+					size_t n = (alloc ? alloc * 2 : 64);
+					struct container_record *tmp;
+
+					if (!(tmp = realloc(c->records, n * sizeof(*tmp)))) {
+						free(data);
+						return -11;
+					}
+					c->records = tmp;
+					alloc = n;
+				}
+				r = &c->records[c->count++];
+				memset(r, 0, sizeof(*r));
+				r->addr = addr;
+				r->len = rec[0];
+				r->data = p;
+			}
+			memcpy(p, rec + 4, rec[0]);
+			p += rec[0];
+		}
+		else if (type == 0x01) {
+			break;
+		}
+		else if (type == 0x02 && rec[0] == 2) {
+			base = ((rec[4] << 8) | rec[5]) << 4;
+		}
+		else if (type == 0x04 && rec[0] == 2) {
+			base = ((uint32_t)rec[4] << 24) | (rec[5] << 16);
+		}
+		else if ((type == 0x03 || type == 0x05) && rec[0] == 4) {
+			/* Start address is kept, so that it can be written back */
+			c->start_type = type;
+			c->start_addr = ((uint32_t)rec[4] << 24) | (rec[5] << 16)
+				| (rec[6] << 8) | rec[7];
+		}
+
+		s = next;
+	}
+
+	/* Text is not needed anymore */
+	free(c->buf);
+	c->buf = data;
+
+	return 0;
+}
+
+
+int container_load(const char *filename, struct container **container)
+{
+	struct container *c;
+	off_t size;
+	int fd, res;
+
+
+	if (!filename || !container)
+		return -1;
+	if (!(c = calloc(1, sizeof(struct container))))
+		return -2;
+	if ((c->type = container_detect(filename)) <= CONTAINER_NONE) {
+		free(c);
+		return -3;
+	}
+
+	/* Read the whole file with a single read */
+	if ((fd = open_file(filename, true)) < 0) {
+		free(c);
+		return -4;
+	}
+	if ((size = file_size(fd)) < 0 || !(c->buf = malloc(size + 1))
+		|| read_file(fd, 0, c->buf, size)) {
+		close(fd);
+		container_free(c);
+		return -5;
+	}
+	close(fd);
+
+	if (c->type == CONTAINER_UF2)
+		res = load_uf2(c, size);
+	else
+		res = load_ihex(c, size);
+	if (res) {
+		container_free(c);
+		return res;
+	}
+
+	/* Files are normally written in address order */
+	for (size_t i = 1; i < c->count; i++) {
+		if (c->records[i].addr < c->records[i - 1].addr) {
+			qsort(c->records, c->count, sizeof(struct container_record), cmp_record);
+			break;
+		}
+	}
+
+	*container = c;
+
+	return 0;
+}
+
+
+void container_read(const struct container *c, uint64_t addr, void *buf, size_t len,
+		uint8_t fill)
+{
+	uint64_t end = addr + len;
+	size_t lo = 0, hi;
+
+	memset(buf, fill, len);
+	if (!c || c->count == 0)
+		return;
+
+	/* Find last record starting at (or before) addr */
+	hi = c->count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (c->records[mid].addr <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	for (size_t i = lo; i < c->count && c->records[i].addr < end; i++) {
+		const struct container_record *r = &c->records[i];
+		uint64_t start = (r->addr > addr ? r->addr : addr);
+		uint64_t stop = ((uint64_t)r->addr + r->len < end ? (uint64_t)r->addr + r->len : end);
+
+		if (start < stop)
+			memcpy((uint8_t*)buf + (start - addr), r->data + (start - r->addr),
+				stop - start);
+	}
+}
+
+
+uint64_t container_end(const struct container *c)
+{
+	uint64_t end = 0;
+
+	for (size_t i = 0; i < c->count; i++) {
+		if ((uint64_t)c->records[i].addr + c->records[i].len > end)
+			end = (uint64_t)c->records[i].addr + c->records[i].len;
+	}
+
+	return end;
+}
+
+
+void container_free(struct container *c)
+{
+	if (!c)
+		return;
+	free(c->records);
+	free(c->extra);
+	free(c->buf);
+	free(c);
+}
@@ -0,0 +1,73 @@
+/* container.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CONTAINER_H_
+#define _CONTAINER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define CONTAINER_NONE 0
+#define CONTAINER_UF2  1
+#define CONTAINER_IHEX 2
+
+
+struct container_record {
+	uint32_t addr;
+	uint32_t len;
+	const uint8_t *data;
+	const uint8_t *block;  /* original UF2 block (NULL = Intel HEX) */
+	uint32_t flags;        /* UF2 flags */
+	uint32_t family_id;    /* UF2 family ID */
+};
+
+struct container {
+	int type;
+	uint8_t *buf;                     /* record data */
+	struct container_record *records; /* sorted by address */
+	size_t count;
+	struct container_record *extra;   /* UF2 blocks not for main flash */
+	size_t extra_count;
+	uint32_t family_id;               /* UF2 family ID (0 = none) */
+	uint8_t start_type;               /* Intel HEX start address record (0 = none) */
+	uint32_t start_addr;              /* CS:IP (type 03) or EIP (type 05) */
+};
+
+
+int container_detect(const char *filename);
+int container_load(const char *filename, struct container **container);
+void container_read(const struct container *c, uint64_t addr, void *buf, size_t len,
+		uint8_t fill);
+uint64_t container_end(const struct container *c);
+void container_free(struct container *c);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CONTAINER_H_ */
@@ -0,0 +1,460 @@
+/* delta.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Block level binary delta between two images.
+ *
+ * Patch format (all values are little-endian):
+ *
+ *   header:
+ *     uint32_t magic;          "LFSD"
+ *     uint16_t version;        1
+ *     uint16_t header_size;    40
+ *     uint32_t block_size;     erase block size used for comparison
+ *     uint32_t range_count;
+ *     uint64_t old_size;
+ *     uint64_t new_size;
+ *     uint32_t old_crc;        CRC-32 of the old image
+ *     uint32_t new_crc;        CRC-32 of the new image
+ *
+ *   ranges[range_count]:
+ *     uint32_t first_block;
+ *     uint32_t block_count;
+ *     uint32_t crc;            CRC-32 of range data
+ *     uint8_t  data[];         block_count blocks (last block in image may be partial)
+ *
+ *   uint32_t crc;              CRC-32 of all preceding bytes
+ *
+ * CRC-32 is the same CRC as used by littlefs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <lfs.h>
+#include <lfs_util.h>
+
+#include "littlefs-toy.h"
+
+#define DELTA_MAGIC 0x4453464c /* "LFSD" */
+#define DELTA_VERSION 1
+#define DELTA_HEADER_SIZE 40
+#define DELTA_CHUNK_SIZE (1024 * 1024)
+
+
+struct delta_buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+};
+
+
+static int buf_append(struct delta_buf *b, const void *data, size_t len)
+{
+	if (b->len + len > b->alloc) {
+		size_t alloc = (b->alloc ? b->alloc : 65536);
+		uint8_t *p;
+
+		while (alloc < b->len + len)
+			alloc *= 2;
+		if (!(p = realloc(b->data, alloc)))
+			return -1;
+		b->data = p;
+		b->alloc = alloc;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+static void put_u16(uint8_t *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+}
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	put_u16(p, val & 0xffff);
+	put_u16(p + 2, val >> 16);
+}
+
+static void put_u64(uint8_t *p, uint64_t val)
+{
+	put_u32(p, val & 0xffffffff);
+	put_u32(p + 4, val >> 32);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+
+static off_t image_region_size(int fd, off_t offset)
+{
+	off_t size = file_size(fd);
+
+	if (size < 0 || size < offset)
+		return -1;
+
+	return size - offset;
+}
+
+
+static int region_crc(int fd, off_t offset, off_t size, uint32_t *crc)
+{
+	void *buf;
+	off_t pos = 0;
+
+	if (!(buf = malloc(DELTA_CHUNK_SIZE)))
+		return -1;
+
+	*crc = 0xffffffff;
+	while (pos < size) {
+		size_t len = (size - pos > DELTA_CHUNK_SIZE ? DELTA_CHUNK_SIZE : size - pos);
+
+		if (read_file(fd, offset + pos, buf, len)) {
+			free(buf);
+			return -2;
+		}
+		*crc = lfs_crc(*crc, buf, len);
+		pos += len;
+	}
+	free(buf);
+
+	return 0;
+}
+
+
+static int flush_range(struct delta_buf *b, uint32_t first, uint32_t count,
+		const uint8_t *data, size_t len, uint32_t *ranges)
+{
+	uint8_t hdr[12];
+
+	put_u32(hdr, first);
+	put_u32(hdr + 4, count);
+	put_u32(hdr + 8, lfs_crc(0xffffffff, data, len));
+	if (buf_append(b, hdr, sizeof(hdr)) || buf_append(b, data, len))
+		return -1;
+	(*ranges)++;
+
+	return 0;
+}
+
+
+int delta_create(const char *old_file, const char *new_file, const char *patch_file,
+		size_t block_size, off_t offset, bool verbose)
+{
+	struct delta_buf b = { NULL, 0, 0 };
+	struct delta_buf range = { NULL, 0, 0 };
+	uint8_t hdr[DELTA_HEADER_SIZE];
+	uint8_t *old_buf = NULL, *new_buf = NULL;
+	uint32_t old_crc = 0xffffffff, new_crc = 0xffffffff;
+	uint32_t ranges = 0, range_first = 0, range_count = 0;
+	uint32_t changed = 0;
+	off_t old_size, new_size, pos = 0;
+	size_t chunk;
+	int old_fd, new_fd, fd;
+	int res = 0;
+
+
+	if (!old_file || !new_file || !patch_file || block_size < 1)
+		return -1;
+
+	if ((old_fd = open_file(old_file, true)) < 0) {
+		warn("%s: cannot open file", old_file);
+		return -2;
+	}
+	if ((new_fd = open_file(new_file, true)) < 0) {
+		warn("%s: cannot open file", new_file);
+		close(old_fd);
+		return -2;
+	}
+	old_size = image_region_size(old_fd, offset);
+	new_size = image_region_size(new_fd, offset);
+	if (old_size < 0 || new_size < 0)
+		res = -3;
+
+	chunk = (DELTA_CHUNK_SIZE / block_size + 1) * block_size;
+	if (res == 0) {
+		if (!(old_buf = malloc(chunk)) || !(new_buf = malloc(chunk)))
+			res = -4;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	if (res == 0 && buf_append(&b, hdr, sizeof(hdr)))
+		res = -4;
+
+	/* Compare images one erase block at a time */
+	while (res == 0 && pos < new_size) {
+		size_t new_len = (new_size - pos > (off_t)chunk ? chunk : (size_t)(new_size - pos));
+		size_t old_len = (old_size - pos > (off_t)new_len ? new_len
+				: (old_size > pos ? (size_t)(old_size - pos) : 0));
+
+		if (read_file(new_fd, offset + pos, new_buf, new_len)
+			|| (old_len > 0 && read_file(old_fd, offset + pos, old_buf, old_len))) {
+			res = -5;
+			break;
+		}
+		new_crc = lfs_crc(new_crc, new_buf, new_len);
+		if (old_len > 0)
+			old_crc = lfs_crc(old_crc, old_buf, old_len);
+
+		for (size_t o = 0; o < new_len; o += block_size) {
+			size_t len = (new_len - o > block_size ? block_size : new_len - o);
+			uint32_t block = (pos + o) / block_size;
+			bool same = (o + len <= old_len && !memcmp(old_buf + o, new_buf + o, len));
+
+			if (!same) {
+				if (range_count > 0 && range_first + range_count != block) {
+					res = flush_range(&b, range_first, range_count,
+							range.data, range.len, &ranges);
+					range.len = 0;
+					range_count = 0;
+				}
+				if (range_count == 0)
+					range_first = block;
+				range_count++;
+				changed++;
+				if (buf_append(&range, new_buf + o, len))
+					res = -4;
+			}
+			if (res)
+				break;
+		}
+		pos += new_len;
+	}
+
+	/* Rest of the old image (if new image is smaller) */
+	while (res == 0 && pos < old_size) {
+		size_t len = (old_size - pos > (off_t)chunk ? chunk : (size_t)(old_size - pos));
+
+		if (read_file(old_fd, offset + pos, old_buf, len)) {
+			res = -5;
+			break;
+		}
+		old_crc = lfs_crc(old_crc, old_buf, len);
+		pos += len;
+	}
+
+	if (res == 0 && range_count > 0)
+		res = flush_range(&b, range_first, range_count, range.data, range.len, &ranges);
+
+	if (res == 0) {
+		uint8_t crc[4];
+
+		put_u32(b.data, DELTA_MAGIC);
+		put_u16(b.data + 4, DELTA_VERSION);
+		put_u16(b.data + 6, DELTA_HEADER_SIZE);
+		put_u32(b.data + 8, block_size);
+		put_u32(b.data + 12, ranges);
+		put_u64(b.data + 16, old_size);
+		put_u64(b.data + 24, new_size);
+		put_u32(b.data + 32, old_crc);
+		put_u32(b.data + 36, new_crc);
+		put_u32(crc, lfs_crc(0xffffffff, b.data, b.len));
+		if (buf_append(&b, crc, sizeof(crc)))
+			res = -4;
+	}
+
+	if (res == 0) {
+		if ((fd = create_file(patch_file, 0)) < 0) {
+			res = -6;
+		} else {
+			if (write_file(fd, 0, b.data, b.len))
+				res = -7;
+			close(fd);
+		}
+	}
+
+	if (res == 0 && verbose)
+		printf("%u blocks changed (in %u ranges), patch size: %zu bytes\n",
+			changed, ranges, b.len);
+
+	close(old_fd);
+	close(new_fd);
+	free(old_buf);
+	free(new_buf);
+	free(range.data);
+	free(b.data);
+
+	return res;
+}
+
+
+int delta_apply(const char *image_file, const char *patch_file, off_t offset, bool verbose)
+{
+	uint8_t *patch = NULL;
+	uint32_t block_size, ranges, old_crc, new_crc, crc;
+	uint64_t old_size, new_size;
+	off_t patch_size, image_size;
+	size_t pos;
+	int fd = -1, pfd;
+	int res = 0;
+
+
+	if (!image_file || !patch_file)
+		return -1;
+
+	/* Read and validate patch */
+	if ((pfd = open_file(patch_file, true)) < 0) {
+		warn("%s: cannot open file", patch_file);
+		return -2;
+	}
+	patch_size = file_size(pfd);
+	if (patch_size < DELTA_HEADER_SIZE + 4)
+		res = -3;
+	else if (!(patch = malloc(patch_size)))
+		res = -4;
+	else if (read_file(pfd, 0, patch, patch_size))
+		res = -5;
+	close(pfd);
+
+	if (res == 0) {
+		if (get_u32(patch) != DELTA_MAGIC || get_u16(patch + 4) != DELTA_VERSION
+			|| get_u16(patch + 6) != DELTA_HEADER_SIZE) {
+			warn("%s: not a delta patch file", patch_file);
+			res = -6;
+		}
+		else if (lfs_crc(0xffffffff, patch, patch_size - 4)
+			!= get_u32(patch + patch_size - 4)) {
+			warn("%s: patch file CRC mismatch", patch_file);
+			res = -7;
+		}
+	}
+	if (res) {
+		free(patch);
+		return res;
+	}
+
+	block_size = get_u32(patch + 8);
+	ranges = get_u32(patch + 12);
+	old_size = get_u64(patch + 16);
+	new_size = get_u64(patch + 24);
+	old_crc = get_u32(patch + 32);
+	new_crc = get_u32(patch + 36);
+
+	/* Check that image matches the old image */
+	if ((fd = open_file(image_file, false)) < 0) {
+		warn("%s: cannot open file", image_file);
+		res = -8;
+	}
+	else if ((image_size = image_region_size(fd, offset)) < (off_t)old_size) {
+		warn("%s: image too small for the patch", image_file);
+		res = -9;
+	}
+	else if (region_crc(fd, offset, old_size, &crc)) {
+		res = -10;
+	}
+	else if (crc != old_crc) {
+		if (image_size >= (off_t)new_size && !region_crc(fd, offset, new_size, &crc)
+			&& crc == new_crc) {
+			if (verbose)
+				printf("%s: patch already applied\n", image_file);
+		} else {
+			warn("%s: image does not match the patch", image_file);
+			res = -11;
+		}
+		free(patch);
+		close(fd);
+		return res;
+	}
+
+	/* Validate ranges before writing anything */
+	pos = DELTA_HEADER_SIZE;
+	for (uint32_t i = 0; i < ranges && res == 0; i++) {
+		uint64_t start, len;
+
+		if (pos + 12 > (size_t)patch_size - 4) {
+			res = -12;
+			break;
+		}
+		start = (uint64_t)get_u32(patch + pos) * block_size;
+		len = (uint64_t)get_u32(patch + pos + 4) * block_size;
+		if (start + len > new_size)
+			len = (start < new_size ? new_size - start : 0);
+		if (pos + 12 + len > (size_t)patch_size - 4
+			|| lfs_crc(0xffffffff, patch + pos + 12, len) != get_u32(patch + pos + 8)) {
+			res = -12;
+			break;
+		}
+		pos += 12 + len;
+	}
+	if (res)
+		warn("%s: corrupted patch file", patch_file);
+
+	/* Apply ranges */
+	pos = DELTA_HEADER_SIZE;
+	for (uint32_t i = 0; i < ranges && res == 0; i++) {
+		uint64_t start = (uint64_t)get_u32(patch + pos) * block_size;
+		uint64_t len = (uint64_t)get_u32(patch + pos + 4) * block_size;
+
+		if (start + len > new_size)
+			len = new_size - start;
+		if (write_file(fd, offset + start, patch + pos + 12, len)) {
+			warn("%s: failed to write image (%d)", image_file, errno);
+			res = -13;
+		}
+		pos += 12 + len;
+	}
+
+	/* Truncate standalone image, if new image is smaller */
+	if (res == 0 && offset == 0 && new_size < old_size
+		&& image_size == (off_t)old_size) {
+		if (ftruncate(fd, new_size))
+			res = -14;
+	}
+
+	if (res == 0) {
+		if (region_crc(fd, offset, new_size, &crc) || crc != new_crc) {
+			warn("%s: image CRC mismatch after applying patch", image_file);
+			res = -15;
+		}
+		else if (verbose) {
+			printf("%u ranges applied\n", ranges);
+		}
+	}
+
+	free(patch);
+	close(fd);
+
+	return res;
+}
@@ -0,0 +1,335 @@
+/* export.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Export filesystem image as UF2 or Intel HEX file for flash programming.
+ *
+ * Only blocks in use by the filesystem are exported, and pages that contain
+ * only the erase value are skipped. Programmers erase whole sectors before
+ * writing pages into them, so first page of a (used) block is always
+ * exported to make sure that the block gets erased.
+ *
+ * When writing back a modified firmware container, records of the original
+ * container outside the filesystem are exported as they were (UF2 blocks
+ * are copied as is, only their block numbers are updated).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "container.h"
+#include "export.h"
+#include "littlefs-toy.h"
+
+#define UF2_MAGIC_START0 0x0a324655
+#define UF2_MAGIC_START1 0x9e5d5157
+#define UF2_MAGIC_END    0x0ab16f30
+#define UF2_FLAG_FAMILY_ID 0x00002000
+#define UF2_FLAG_MD5       0x00004000
+#define UF2_FLAG_EXTENSION 0x00008000
+#define UF2_BLOCK_SIZE   512
+
+#define IHEX_RECORD_SIZE 16
+
+
+/* Record is set for data from the original container (NULL for filesystem) */
+typedef int (*export_page_cb)(void *arg, uint32_t addr, const uint8_t *data, uint32_t len,
+		const struct container_record *r);
+
+struct uf2_state {
+	FILE *fp;
+	const struct export_image *img;
+	uint32_t count;
+	uint32_t total;
+	uint64_t bytes;
+};
+
+struct ihex_state {
+	FILE *fp;
+	uint32_t upper;
+};
+
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+
+/* Call callback for (parts of) kept records within given address range */
+static int export_kept(const struct export_image *img, uint64_t start, uint64_t end,
+		export_page_cb cb, void *arg)
+{
+	const struct container *c = img->keep;
+	int res = 0;
+
+	if (!c)
+		return 0;
+
+	for (size_t i = 0; i < c->count && res == 0; i++) {
+		const struct container_record *r = &c->records[i];
+		uint64_t addr = (r->addr > start ? r->addr : start);
+		uint64_t stop = ((uint64_t)r->addr + r->len < end ? (uint64_t)r->addr + r->len : end);
+
+		/* Whole UF2 block is kept as is */
+		if (r->block && addr == r->addr && stop == (uint64_t)r->addr + r->len) {
+			res = cb(arg, r->addr, r->data, r->len, r);
+			continue;
+		}
+		/* Split into chunks that don't cross page boundaries */
+		while (addr < stop && res == 0) {
+			uint64_t next = (addr / EXPORT_PAGE_SIZE + 1) * EXPORT_PAGE_SIZE;
+
+			if (next > stop)
+				next = stop;
+			res = cb(arg, addr, r->data + (addr - r->addr), next - addr, r);
+			addr = next;
+		}
+	}
+
+	return res;
+}
+
+
+/* Call callback for each page to be exported */
+static int export_pages(const struct export_image *img, export_page_cb cb, void *arg)
+{
+	uint64_t fs_end = (uint64_t)img->base_address
+		+ (uint64_t)img->block_size * img->block_count;
+	uint8_t *buf = NULL;
+	int res = 0;
+
+	if (img->block_size % EXPORT_PAGE_SIZE != 0)
+		return -1;
+	if (fs_end > ((uint64_t)1 << 32))
+		return -2;
+	if (!img->buf && !(buf = malloc(img->block_size)))
+		return -3;
+
+	res = export_kept(img, 0, img->base_address, cb, arg);
+
+	for (uint32_t b = 0; b < img->block_count && res == 0; b++) {
+		uint32_t addr = img->base_address + b * img->block_size;
+		const uint8_t *data = buf;
+		bool written = false;
+
+		if (img->used && !(img->used[b / 32] & (1U << (b % 32))))
+			continue;
+		if (img->buf) {
+			data = img->buf + (size_t)b * img->block_size;
+		} else if (read_file(img->fd, img->offset + (off_t)b * img->block_size, buf,
+					img->block_size)) {
+			res = -4;
+			break;
+		}
+		for (uint32_t o = 0; o < img->block_size && res == 0; o += EXPORT_PAGE_SIZE) {
+			/* Blank pages can be skipped only if they match the erased state of
+			   the flash (default erase value 0x00 is not that for NOR flash) */
+			if (written && img->erase_value != 0
+				&& is_blank_buf(data + o, EXPORT_PAGE_SIZE, img->erase_value))
+				continue;
+			res = cb(arg, addr + o, data + o, EXPORT_PAGE_SIZE, NULL);
+			written = true;
+		}
+	}
+	free(buf);
+
+	if (res == 0)
+		res = export_kept(img, fs_end, (uint64_t)1 << 32, cb, arg);
+	/* UF2 blocks not for main flash (kept as is) */
+	for (size_t i = 0; img->keep && i < img->keep->extra_count && res == 0; i++) {
+		const struct container_record *r = &img->keep->extra[i];
+
+		res = cb(arg, r->addr, r->data, r->len, r);
+	}
+
+	return res;
+}
+
+
+static int count_page_cb(void *arg, uint32_t addr, const uint8_t *data, uint32_t len,
+		const struct container_record *r)
+{
+	(void)addr;
+	(void)data;
+	(void)r;
+	((struct uf2_state*)arg)->total++;
+	((struct uf2_state*)arg)->bytes += len;
+
+	return 0;
+}
+
+
+static int uf2_page_cb(void *arg, uint32_t addr, const uint8_t *data, uint32_t len,
+		const struct container_record *r)
+{
+	struct uf2_state *s = (struct uf2_state*)arg;
+	uint8_t blk[UF2_BLOCK_SIZE];
+
+	if (r && r->block && addr == r->addr && len == r->len) {
+		/* Original block (from the container) is kept as is */
+		memcpy(blk, r->block, sizeof(blk));
+	} else {
+		memset(blk, 0, sizeof(blk));
+		put_u32(blk, UF2_MAGIC_START0);
+		put_u32(blk + 4, UF2_MAGIC_START1);
+		if (r && r->block) {
+			/* Part of original block, checksum and extension tags don't apply */
+			put_u32(blk + 8, r->flags & ~(UF2_FLAG_MD5 | UF2_FLAG_EXTENSION));
+			put_u32(blk + 28, r->family_id);
+		} else {
+			put_u32(blk + 8, (s->img->family_id ? UF2_FLAG_FAMILY_ID : 0));
+			put_u32(blk + 28, s->img->family_id);
+		}
+		put_u32(blk + 12, addr);
+		put_u32(blk + 16, len);
+		memcpy(blk + 32, data, len);
+		put_u32(blk + UF2_BLOCK_SIZE - 4, UF2_MAGIC_END);
+	}
+	put_u32(blk + 20, s->count++);
+	put_u32(blk + 24, s->total);
+
+	if (fwrite(blk, sizeof(blk), 1, s->fp) != 1)
+		return -10;
+
+	return 0;
+}
+
+
+int export_uf2(const char *filename, const struct export_image *img, bool verbose)
+{
+	struct uf2_state s;
+	int res;
+
+
+	if (!filename || !img)
+		return -1;
+
+	memset(&s, 0, sizeof(s));
+	s.img = img;
+
+	/* Each UF2 block must contain total number of blocks in the file */
+	if ((res = export_pages(img, count_page_cb, &s)))
+		return res;
+
+	if (!(s.fp = fopen(filename, "wb"))) {
+		warn("%s: cannot create file", filename);
+		return -5;
+	}
+	res = export_pages(img, uf2_page_cb, &s);
+	if (fclose(s.fp) && res == 0)
+		res = -6;
+
+	if (res == 0 && verbose)
+		printf("%s: %u UF2 blocks (%llu bytes of data)\n", filename, s.total,
+			(unsigned long long)s.bytes);
+
+	return res;
+}
+
+
+static int ihex_record(FILE *fp, uint8_t type, uint16_t addr, const uint8_t *data,
+		uint8_t len)
+{
+	uint8_t sum = len + (addr >> 8) + (addr & 0xff) + type;
+
+	fprintf(fp, ":%02X%04X%02X", len, addr, type);
+	for (int i = 0; i < len; i++) {
+		fprintf(fp, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(fp, "%02X\n", (uint8_t)(0x100 - sum));
+
+	return (ferror(fp) ? -10 : 0);
+}
+
+
+static int ihex_page_cb(void *arg, uint32_t addr, const uint8_t *data, uint32_t len,
+		const struct container_record *r)
+{
+	struct ihex_state *s = (struct ihex_state*)arg;
+	int res;
+
+	(void)r;
+
+	/* Extended linear address record, when upper 16 bits of address change */
+	if ((addr >> 16) != s->upper) {
+		uint8_t upper[2] = { addr >> 24, (addr >> 16) & 0xff };
+
+		s->upper = addr >> 16;
+		if ((res = ihex_record(s->fp, 0x04, 0, upper, 2)))
+			return res;
+	}
+
+	for (uint32_t i = 0; i < len; i += IHEX_RECORD_SIZE) {
+		if ((res = ihex_record(s->fp, 0x00, (addr + i) & 0xffff, data + i,
+						(len - i < IHEX_RECORD_SIZE ? len - i : IHEX_RECORD_SIZE))))
+			return res;
+	}
+
+	return 0;
+}
+
+
+int export_ihex(const char *filename, const struct export_image *img, bool verbose)
+{
+	struct ihex_state s;
+	int res;
+
+
+	if (!filename || !img)
+		return -1;
+
+	memset(&s, 0, sizeof(s));
+	if (!(s.fp = fopen(filename, "w"))) {
+		warn("%s: cannot create file", filename);
+		return -5;
+	}
+	res = export_pages(img, ihex_page_cb, &s);
+	if (res == 0 && img->keep && img->keep->start_type) {
+		uint32_t start = img->keep->start_addr;
+		uint8_t data[4] = { start >> 24, (start >> 16) & 0xff, (start >> 8) & 0xff,
+				    start & 0xff };
+
+		res = ihex_record(s.fp, img->keep->start_type, 0, data, 4);
+	}
+	if (res == 0)
+		res = ihex_record(s.fp, 0x01, 0, NULL, 0);
+	if (fclose(s.fp) && res == 0)
+		res = -6;
+
+	if (res == 0 && verbose)
+		printf("%s: Intel HEX file written\n", filename);
+
+	return res;
+}
@@ -0,0 +1,63 @@
+/* export.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct container;
+
+#define EXPORT_PAGE_SIZE 256
+#define UF2_FAMILY_RP2040 0xe48bff56
+
+
+struct export_image {
+	int fd;                 /* image file */
+	off_t offset;           /* filesystem offset in image file */
+	const uint8_t *buf;     /* image in memory (instead of the image file) */
+	uint32_t block_size;
+	uint32_t block_count;
+	const uint32_t *used;   /* bitmap of blocks in use (NULL = all blocks) */
+	uint8_t erase_value;
+	uint32_t base_address;  /* flash address of the filesystem */
+	uint32_t family_id;     /* UF2 family ID (0 = none) */
+	const struct container *keep; /* records to keep outside the filesystem */
+};
+
+
+int export_uf2(const char *filename, const struct export_image *img, bool verbose);
+int export_ihex(const char *filename, const struct export_image *img, bool verbose);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _EXPORT_H_ */
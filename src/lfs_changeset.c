@@ -0,0 +1,551 @@
+/* lfs_changeset.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <lfs.h>
+#include <lfs_util.h>
+
+#include "lfs_changeset.h"
+#include "littlefs-toy.h"
+
+#define CHANGESET_CHUNK_SIZE (64 * 1024)
+
+
+struct tree_entry {
+	char *name;
+	bool dir;
+	lfs_size_t size;
+};
+
+struct entry_list {
+	struct tree_entry *entries;
+	size_t count;
+	size_t alloc;
+};
+
+struct tree_file {
+	lfs_file_t file;
+	int fd;
+};
+
+struct changeset_op {
+	uint8_t op;
+	char *path;
+	lfs_size_t size;
+};
+
+struct op_list {
+	struct changeset_op *ops;
+	size_t count;
+	size_t alloc;
+};
+
+struct changeset {
+	const struct lfs_tree *old_tree;
+	const struct lfs_tree *new_tree;
+	struct op_list deletes;
+	struct op_list updates;
+	uint8_t *buf1;
+	uint8_t *buf2;
+};
+
+
+static void tree_path(const struct lfs_tree *tree, const char *path, char *buf, size_t size)
+{
+	if (tree->lfs)
+		snprintf(buf, size, "/%s", path);
+	else if (*path)
+		snprintf(buf, size, "%s/%s", tree->dir, path);
+	else
+		snprintf(buf, size, "%s", tree->dir);
+}
+
+
+static int add_entry(struct entry_list *list, const char *name, bool dir, lfs_size_t size)
+{
+	struct tree_entry *e;
+
+	if (list->count >= list->alloc) {
+		size_t alloc = (list->alloc ? list->alloc * 2 : 32);
+
+		if (!(e = realloc(list->entries, alloc * sizeof(struct tree_entry))))
+			return -1;
+		list->entries = e;
+		list->alloc = alloc;
+	}
+
+	e = &list->entries[list->count];
+	if (!(e->name = strdup(name)))
+		return -2;
+	e->dir = dir;
+	e->size = size;
+	list->count++;
+
+	return 0;
+}
+
+
+static void free_entries(struct entry_list *list)
+{
+	for (size_t i = 0; i < list->count; i++)
+		free(list->entries[i].name);
+	free(list->entries);
+	memset(list, 0, sizeof(struct entry_list));
+}
+
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct tree_entry *ea = a;
+	const struct tree_entry *eb = b;
+
+	return strcmp(ea->name, eb->name);
+}
+
+
+static int list_tree(const struct lfs_tree *tree, const char *path, struct entry_list *list)
+{
+	char fullname[PATH_MAX + 1];
+	int res = 0;
+
+
+	tree_path(tree, path, fullname, sizeof(fullname));
+
+	if (tree->lfs) {
+		lfs_dir_t dir;
+		struct lfs_info info;
+
+		if ((res = lfs_dir_open(tree->lfs, &dir, fullname)) != LFS_ERR_OK)
+			return res;
+		while ((res = lfs_dir_read(tree->lfs, &dir, &info)) > 0) {
+			/* Skip special directories ("." and "..") */
+			if (info.name[0] == '.') {
+				if (info.name[1] == 0)
+					continue;
+				if (info.name[1] == '.' && info.name[2] == 0)
+					continue;
+			}
+			if (add_entry(list, info.name, info.type == LFS_TYPE_DIR, info.size)) {
+				res = LFS_ERR_NOMEM;
+				break;
+			}
+		}
+		lfs_dir_close(tree->lfs, &dir);
+		if (res > 0)
+			res = 0;
+	} else {
+		DIR *dir;
+		struct dirent *e;
+		struct stat st;
+		char name[PATH_MAX + 1];
+
+		if (!(dir = opendir(fullname))) {
+			warn("%s: failed to open directory", fullname);
+			return -1;
+		}
+		while ((e = readdir(dir))) {
+			/* Skip special directories ("." and "..") */
+			if (e->d_name[0] == '.') {
+				if (e->d_name[1] == 0)
+					continue;
+				if (e->d_name[1] == '.' && e->d_name[2] == 0)
+					continue;
+			}
+			snprintf(name, sizeof(name), "%s/%s", fullname, e->d_name);
+			if (lstat(name, &st)) {
+				warn("cannot stat file: %s", name);
+				continue;
+			}
+			if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+				warn("%s: skip special file", name);
+				continue;
+			}
+			if (add_entry(list, e->d_name, S_ISDIR(st.st_mode),
+						(S_ISDIR(st.st_mode) ? 0 : st.st_size))) {
+				res = -2;
+				break;
+			}
+		}
+		closedir(dir);
+	}
+
+	/* Both trees must be in the same order for the merge walk */
+	if (res == 0)
+		qsort(list->entries, list->count, sizeof(struct tree_entry), compare_entries);
+
+	return res;
+}
+
+
+static int open_tree_file(const struct lfs_tree *tree, const char *path, struct tree_file *f)
+{
+	char fullname[PATH_MAX + 1];
+
+	tree_path(tree, path, fullname, sizeof(fullname));
+
+	if (tree->lfs) {
+		f->fd = -1;
+		return lfs_file_open(tree->lfs, &f->file, fullname, LFS_O_RDONLY);
+	}
+	if ((f->fd = open_file(fullname, true)) < 0) {
+		warn("%s: cannot open file", fullname);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int read_tree_file(const struct lfs_tree *tree, struct tree_file *f, off_t offset,
+			void *buf, size_t len)
+{
+	if (tree->lfs) {
+		if (lfs_file_read(tree->lfs, &f->file, buf, len) != (lfs_ssize_t)len)
+			return -1;
+		return 0;
+	}
+
+	return read_file(f->fd, offset, buf, len);
+}
+
+
+static void close_tree_file(const struct lfs_tree *tree, struct tree_file *f)
+{
+	if (tree->lfs)
+		lfs_file_close(tree->lfs, &f->file);
+	else
+		close(f->fd);
+}
+
+
+static int same_content(struct changeset *cs, const char *path, lfs_size_t size)
+{
+	struct tree_file old_f, new_f;
+	off_t pos = 0;
+	int res = 1;
+
+
+	if (open_tree_file(cs->old_tree, path, &old_f))
+		return -1;
+	if (open_tree_file(cs->new_tree, path, &new_f)) {
+		close_tree_file(cs->old_tree, &old_f);
+		return -2;
+	}
+
+	/* Compare files one chunk at a time, stop at first difference */
+	while (pos < size && res == 1) {
+		size_t len = (size - pos > CHANGESET_CHUNK_SIZE ? CHANGESET_CHUNK_SIZE
+			: (size_t)(size - pos));
+
+		if (read_tree_file(cs->old_tree, &old_f, pos, cs->buf1, len)
+			|| read_tree_file(cs->new_tree, &new_f, pos, cs->buf2, len))
+			res = -3;
+		else if (memcmp(cs->buf1, cs->buf2, len))
+			res = 0;
+		pos += len;
+	}
+
+	close_tree_file(cs->old_tree, &old_f);
+	close_tree_file(cs->new_tree, &new_f);
+
+	return res;
+}
+
+
+static int add_op(struct op_list *list, uint8_t op, const char *path, lfs_size_t size)
+{
+	struct changeset_op *o;
+
+	if (list->count >= list->alloc) {
+		size_t alloc = (list->alloc ? list->alloc * 2 : 64);
+
+		if (!(o = realloc(list->ops, alloc * sizeof(struct changeset_op))))
+			return -1;
+		list->ops = o;
+		list->alloc = alloc;
+	}
+
+	o = &list->ops[list->count];
+	if (!(o->path = strdup(path)))
+		return -2;
+	o->op = op;
+	o->size = size;
+	list->count++;
+
+	return 0;
+}
+
+
+static void join_path(char *buf, size_t size, const char *path, const char *name)
+{
+	snprintf(buf, size, "%s%s%s", path, (*path ? "/" : ""), name);
+}
+
+
+static int delete_tree(struct changeset *cs, const char *path, bool dir)
+{
+	struct entry_list list = { NULL, 0, 0 };
+	char child[LFS_NAME_MAX * 2];
+	int res = 0;
+
+	if (dir) {
+		/* Directory contents must be deleted before the directory itself */
+		if ((res = list_tree(cs->old_tree, path, &list)) == 0) {
+			for (size_t i = 0; i < list.count && res == 0; i++) {
+				join_path(child, sizeof(child), path, list.entries[i].name);
+				res = delete_tree(cs, child, list.entries[i].dir);
+			}
+		}
+		free_entries(&list);
+	}
+	if (res == 0)
+		res = add_op(&cs->deletes, LFS_CHANGESET_OP_DELETE, path, 0);
+
+	return res;
+}
+
+
+static int add_tree(struct changeset *cs, const char *path, const struct tree_entry *e)
+{
+	struct entry_list list = { NULL, 0, 0 };
+	char child[LFS_NAME_MAX * 2];
+	int res;
+
+	if (!e->dir)
+		return add_op(&cs->updates, LFS_CHANGESET_OP_ADD, path, e->size);
+
+	if ((res = add_op(&cs->updates, LFS_CHANGESET_OP_MKDIR, path, 0)))
+		return res;
+	if ((res = list_tree(cs->new_tree, path, &list)) == 0) {
+		for (size_t i = 0; i < list.count && res == 0; i++) {
+			join_path(child, sizeof(child), path, list.entries[i].name);
+			res = add_tree(cs, child, &list.entries[i]);
+		}
+	}
+	free_entries(&list);
+
+	return res;
+}
+
+
+static int walk_trees(struct changeset *cs, const char *path)
+{
+	struct entry_list old_list = { NULL, 0, 0 };
+	struct entry_list new_list = { NULL, 0, 0 };
+	char child[LFS_NAME_MAX * 2];
+	size_t i = 0, j = 0;
+	int res;
+
+
+	if ((res = list_tree(cs->old_tree, path, &old_list)) == 0)
+		res = list_tree(cs->new_tree, path, &new_list);
+
+	/* Merge sorted directory listings */
+	while (res == 0 && (i < old_list.count || j < new_list.count)) {
+		struct tree_entry *o = (i < old_list.count ? &old_list.entries[i] : NULL);
+		struct tree_entry *n = (j < new_list.count ? &new_list.entries[j] : NULL);
+		int cmp = (!o ? 1 : (!n ? -1 : strcmp(o->name, n->name)));
+
+		join_path(child, sizeof(child), path, (cmp > 0 ? n->name : o->name));
+
+		if (cmp < 0) {
+			res = delete_tree(cs, child, o->dir);
+			i++;
+		}
+		else if (cmp > 0) {
+			res = add_tree(cs, child, n);
+			j++;
+		}
+		else {
+			if (o->dir && n->dir) {
+				res = walk_trees(cs, child);
+			}
+			else if (o->dir != n->dir) {
+				if ((res = delete_tree(cs, child, o->dir)) == 0)
+					res = add_tree(cs, child, n);
+			}
+			else if (o->size != n->size) {
+				res = add_op(&cs->updates, LFS_CHANGESET_OP_REPLACE, child, n->size);
+			}
+			else if ((res = same_content(cs, child, n->size)) >= 0) {
+				res = (res ? 0 : add_op(&cs->updates, LFS_CHANGESET_OP_REPLACE,
+								child, n->size));
+			}
+			i++;
+			j++;
+		}
+	}
+
+	free_entries(&old_list);
+	free_entries(&new_list);
+
+	return res;
+}
+
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+
+static int write_chunk(int fd, off_t *pos, uint32_t *crc, void *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	if (write_file(fd, *pos, data, len))
+		return -1;
+	*crc = lfs_crc(*crc, data, len);
+	*pos += len;
+
+	return 0;
+}
+
+
+static int write_op(struct changeset *cs, const struct changeset_op *op, int fd,
+		off_t *pos, uint32_t *stream_crc)
+{
+	struct tree_file f;
+	uint8_t hdr[12];
+	uint8_t *data = NULL;
+	size_t path_len = strlen(op->path) + 1;
+	char path[LFS_NAME_MAX * 2 + 1];
+	int res = 0;
+
+
+	/* Paths are stored as absolute littlefs paths */
+	snprintf(path, sizeof(path), "/%s", op->path);
+
+	if (op->size > 0) {
+		if (!(data = malloc(op->size)))
+			return -1;
+		if (open_tree_file(cs->new_tree, op->path, &f)) {
+			free(data);
+			return -2;
+		}
+		if (read_tree_file(cs->new_tree, &f, 0, data, op->size))
+			res = -3;
+		close_tree_file(cs->new_tree, &f);
+	}
+
+	if (res == 0) {
+		hdr[0] = op->op;
+		hdr[1] = 0;
+		hdr[2] = path_len & 0xff;
+		hdr[3] = (path_len >> 8) & 0xff;
+		put_u32(hdr + 4, op->size);
+		put_u32(hdr + 8, lfs_crc(lfs_crc(0xffffffff, path, path_len),
+						(data ? data : (uint8_t*)""), op->size));
+		if (write_chunk(fd, pos, stream_crc, hdr, sizeof(hdr))
+			|| write_chunk(fd, pos, stream_crc, path, path_len)
+			|| write_chunk(fd, pos, stream_crc, data, op->size))
+			res = -4;
+	}
+	free(data);
+
+	return res;
+}
+
+
+static void free_ops(struct op_list *list)
+{
+	for (size_t i = 0; i < list->count; i++)
+		free(list->ops[i].path);
+	free(list->ops);
+}
+
+
+int lfs_write_changeset(const struct lfs_tree *old_tree, const struct lfs_tree *new_tree,
+		int fd, bool verbose)
+{
+	static const char *op_names[] = { "end", "add", "replace", "delete", "mkdir" };
+	struct changeset cs;
+	uint8_t hdr[12];
+	uint32_t crc = 0xffffffff;
+	off_t pos = 0;
+	int res = 0;
+
+
+	if (!old_tree || !new_tree || fd < 0)
+		return -1;
+
+	memset(&cs, 0, sizeof(cs));
+	cs.old_tree = old_tree;
+	cs.new_tree = new_tree;
+	if (!(cs.buf1 = malloc(CHANGESET_CHUNK_SIZE)) || !(cs.buf2 = malloc(CHANGESET_CHUNK_SIZE)))
+		res = -2;
+
+	if (res == 0)
+		res = walk_trees(&cs, "");
+
+	if (res == 0) {
+		put_u32(hdr, LFS_CHANGESET_MAGIC);
+		hdr[4] = LFS_CHANGESET_VERSION;
+		hdr[5] = 0;
+		hdr[6] = sizeof(hdr);
+		hdr[7] = 0;
+		put_u32(hdr + 8, cs.deletes.count + cs.updates.count);
+		if (write_chunk(fd, &pos, &crc, hdr, sizeof(hdr)))
+			res = -3;
+	}
+
+	/* Deletes first, so that space is available for the new files */
+	for (int pass = 0; pass < 2 && res == 0; pass++) {
+		struct op_list *list = (pass == 0 ? &cs.deletes : &cs.updates);
+
+		for (size_t i = 0; i < list->count && res == 0; i++) {
+			if (verbose)
+				printf("%-8s /%s\n", op_names[list->ops[i].op], list->ops[i].path);
+			res = write_op(&cs, &list->ops[i], fd, &pos, &crc);
+		}
+	}
+
+	if (res == 0) {
+		memset(hdr, 0, sizeof(hdr));
+		hdr[0] = LFS_CHANGESET_OP_END;
+		put_u32(hdr + 8, crc);
+		if (write_file(fd, pos, hdr, sizeof(hdr)))
+			res = -5;
+	}
+
+	free_ops(&cs.deletes);
+	free_ops(&cs.updates);
+	free(cs.buf1);
+	free(cs.buf2);
+
+	return res;
+}
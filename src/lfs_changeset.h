@@ -0,0 +1,91 @@
+/* lfs_changeset.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LFS_CHANGESET_H_
+#define _LFS_CHANGESET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <lfs.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/*
+ * File level changeset format (all values are little-endian):
+ *
+ *   header:
+ *     uint32_t magic;          "LFSC"
+ *     uint16_t version;        1
+ *     uint16_t header_size;    12
+ *     uint32_t op_count;       number of operations (excluding end record)
+ *
+ *   records[op_count]:
+ *     uint8_t  op;             LFS_CHANGESET_OP_*
+ *     uint8_t  reserved;
+ *     uint16_t path_len;
+ *     uint32_t data_size;      size of file data (add/replace only)
+ *     uint32_t crc;            CRC-32 of path and data
+ *     char     path[];         absolute path (without terminating zero)
+ *     uint8_t  data[];
+ *
+ *   end record:
+ *     op = LFS_CHANGESET_OP_END, path_len = 0, data_size = 0,
+ *     crc = CRC-32 of all preceding bytes in the changeset
+ *
+ * Deletes are stored first (directory contents before the directory itself),
+ * followed by directories to create and files to add/replace (parent directory
+ * before its contents), so records can be applied in order using plain littlefs
+ * calls: lfs_remove(), lfs_mkdir() and lfs_file_write() (with LFS_O_TRUNC).
+ *
+ * CRC-32 is the same CRC as used by littlefs.
+ */
+
+#define LFS_CHANGESET_MAGIC 0x4353464c /* "LFSC" */
+#define LFS_CHANGESET_VERSION 1
+
+#define LFS_CHANGESET_OP_END     0
+#define LFS_CHANGESET_OP_ADD     1
+#define LFS_CHANGESET_OP_REPLACE 2
+#define LFS_CHANGESET_OP_DELETE  3
+#define LFS_CHANGESET_OP_MKDIR   4
+
+
+/* Source of a tree: either mounted filesystem image or directory on the host */
+struct lfs_tree {
+	lfs_t *lfs;
+	const char *dir;
+};
+
+
+int lfs_write_changeset(const struct lfs_tree *old_tree, const struct lfs_tree *new_tree,
+		int fd, bool verbose);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _LFS_CHANGESET_H_ */
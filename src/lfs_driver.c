@@ -27,6 +27,7 @@
 #include "win32_compat.h"
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -34,12 +35,41 @@
 #include <sys/errno.h>
 #endif
 #include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <pthread.h>
 #include <lfs.h>
 #include <lfs_util.h>
 
 #include "lfs_driver.h"
 
+#define PROBE_MIN_BLOCK_SIZE 128
+#define PROBE_MAX_BLOCK_SIZE (1024 * 1024)
+
+#define PAGE_DIRTY 0x01
+#define PAGE_REF   0x02
+#define PAGE_SLOT_FREE ((lfs_block_t)-1)
+
+
+/* Block cache for paged contexts. Blocks are loaded from the image file
+   when first accessed. With memory budget, pages are allocated from
+   a fixed size pool, and least recently used blocks are evicted (using
+   clock algorithm) to make room for new blocks. */
+struct lfs_page_cache {
+	size_t max_memory;
+	bool huge_pages;
+	void **pages;          /* resident blocks (indexed by block number) */
+	uint8_t *flags;        /* PAGE_* flags (indexed by block number) */
+	lfs_size_t size;       /* size of page table (in blocks) */
+	uint8_t *pool;
+	size_t pool_size;
+	lfs_block_t *slots;    /* block stored in each pool slot */
+	size_t slot_count;
+	size_t used;
+	size_t clock;
+};
+
 
 static ssize_t read_fd(int fd, void *buf, size_t count)
 {
@@ -75,6 +105,243 @@ static ssize_t write_fd(int fd, const void *buf, size_t count)
 }
 
 
+static int page_table_grow(struct lfs_page_cache *pc, lfs_block_t block)
+{
+	uint64_t size = (pc->size > 0 ? pc->size : 64);
+	uint8_t *flags;
+	void **pages;
+
+	if (block < pc->size)
+		return LFS_ERR_OK;
+
+	while (size <= block)
+		size *= 2;
+	if (size > UINT32_MAX)
+		size = UINT32_MAX;
+
+	if (!(pages = realloc(pc->pages, size * sizeof(void*))))
+		return LFS_ERR_NOMEM;
+	pc->pages = pages;
+	if (!(flags = realloc(pc->flags, size)))
+		return LFS_ERR_NOMEM;
+	pc->flags = flags;
+	memset(pc->pages + pc->size, 0, (size - pc->size) * sizeof(void*));
+	memset(pc->flags + pc->size, 0, size - pc->size);
+	pc->size = size;
+
+	return LFS_ERR_OK;
+}
+
+
+static int page_write(struct lfs_context *ctx, lfs_block_t block)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+	lfs_size_t bs = ctx->cfg.block_size;
+	off_t f_offset = ctx->offset + ((off_t)block * bs);
+
+	if (lseek(ctx->fd, f_offset, SEEK_SET) < 0) {
+		LFS_ERROR("seek failed: %lld", (long long)f_offset);
+		return LFS_ERR_IO;
+	}
+	if (write_fd(ctx->fd, pc->pages[block], bs) < bs) {
+		LFS_ERROR("failed to write file");
+		return LFS_ERR_IO;
+	}
+	pc->flags[block] &= ~PAGE_DIRTY;
+
+	return LFS_ERR_OK;
+}
+
+
+static int page_pool_init(struct lfs_context *ctx)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+	lfs_size_t bs = ctx->cfg.block_size;
+
+	if ((pc->slot_count = pc->max_memory / bs) < 1)
+		pc->slot_count = 1;
+	pc->pool_size = pc->slot_count * bs;
+	if (!(pc->slots = calloc(pc->slot_count, sizeof(lfs_block_t))))
+		return LFS_ERR_NOMEM;
+
+#ifdef HAVE_SYS_MMAN_H
+	pc->pool = mmap(NULL, pc->pool_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pc->pool == MAP_FAILED) {
+		pc->pool = NULL;
+		return LFS_ERR_NOMEM;
+	}
+#ifdef MADV_HUGEPAGE
+	if (pc->huge_pages)
+		madvise(pc->pool, pc->pool_size, MADV_HUGEPAGE);
+#endif
+#else
+	if (!(pc->pool = malloc(pc->pool_size)))
+		return LFS_ERR_NOMEM;
+#endif
+	pc->used = 0;
+	pc->clock = 0;
+
+	return LFS_ERR_OK;
+}
+
+
+static void page_pool_free(struct lfs_page_cache *pc)
+{
+	if (pc->pool) {
+#ifdef HAVE_SYS_MMAN_H
+		munmap(pc->pool, pc->pool_size);
+#else
+		free(pc->pool);
+#endif
+	}
+	free(pc->slots);
+	pc->pool = NULL;
+	pc->slots = NULL;
+	pc->slot_count = 0;
+	pc->used = 0;
+}
+
+
+/* Allocate memory for a block, evicting another block if needed. */
+static int page_alloc(struct lfs_context *ctx, lfs_block_t block, void **page)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+	lfs_size_t bs = ctx->cfg.block_size;
+	size_t slot;
+	int res;
+
+	if (pc->max_memory == 0) {
+		if (!(*page = malloc(bs)))
+			return LFS_ERR_NOMEM;
+		return LFS_ERR_OK;
+	}
+
+	if (!pc->pool) {
+		if ((res = page_pool_init(ctx)))
+			return res;
+	}
+
+	if (pc->used < pc->slot_count) {
+		slot = pc->used++;
+	} else {
+		while (1) {
+			lfs_block_t b;
+
+			slot = pc->clock;
+			pc->clock = (pc->clock + 1) % pc->slot_count;
+			if ((b = pc->slots[slot]) == PAGE_SLOT_FREE)
+				break;
+			if (pc->flags[b] & PAGE_REF) {
+				pc->flags[b] &= ~PAGE_REF;
+				continue;
+			}
+			if (pc->flags[b] & PAGE_DIRTY) {
+				if ((res = page_write(ctx, b)))
+					return res;
+			}
+			pc->pages[b] = NULL;
+			pc->flags[b] = 0;
+			break;
+		}
+	}
+
+	pc->slots[slot] = block;
+	*page = pc->pool + slot * bs;
+
+	return LFS_ERR_OK;
+}
+
+
+static void page_release(struct lfs_context *ctx, lfs_block_t block, void *page)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+
+	if (pc->max_memory == 0)
+		free(page);
+	else
+		pc->slots[((uint8_t*)page - pc->pool) / ctx->cfg.block_size] = PAGE_SLOT_FREE;
+	pc->pages[block] = NULL;
+	pc->flags[block] = 0;
+}
+
+
+/* Return pointer to a block in paged context, loading the block from
+   the image file if it is not already in memory. */
+static int page_get(struct lfs_context *ctx, lfs_block_t block, bool write, bool load,
+		void **page)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+	lfs_size_t bs = ctx->cfg.block_size;
+	void *p;
+	int res;
+
+	if ((res = page_table_grow(pc, block)))
+		return res;
+
+	if (!pc->pages[block]) {
+		if ((res = page_alloc(ctx, block, &p)))
+			return res;
+		if (load) {
+			off_t f_offset = ctx->offset + ((off_t)block * bs);
+
+			if (lseek(ctx->fd, f_offset, SEEK_SET) < 0
+				|| read_fd(ctx->fd, p, bs) < bs) {
+				LFS_ERROR("failed to read block %u from file", block);
+				page_release(ctx, block, p);
+				return LFS_ERR_IO;
+			}
+		}
+		pc->pages[block] = p;
+	}
+
+	pc->flags[block] |= PAGE_REF | (write ? PAGE_DIRTY : 0);
+	*page = pc->pages[block];
+
+	return LFS_ERR_OK;
+}
+
+
+static void page_drop_all(struct lfs_context *ctx)
+{
+	struct lfs_page_cache *pc = ctx->cache;
+
+	if (pc->max_memory == 0) {
+		for (lfs_size_t i = 0; i < pc->size; i++)
+			free(pc->pages[i]);
+	}
+	page_pool_free(pc);
+	free(pc->pages);
+	free(pc->flags);
+	pc->pages = NULL;
+	pc->flags = NULL;
+	pc->size = 0;
+}
+
+
+/* Return pointer to a block in memory image. With copy-on-write context
+   unmodified blocks are read from the shared base image, and a private copy
+   of the block is made when it is modified for the first time. */
+static void* mem_block(struct lfs_context *ctx, lfs_block_t block, bool write)
+{
+	const struct lfs_config *c = &ctx->cfg;
+	void *base = ctx->base + ((size_t)block * c->block_size);
+
+	if (!ctx->blocks)
+		return base;
+	if (ctx->blocks[block])
+		return ctx->blocks[block];
+	if (!write)
+		return base;
+
+	if (!(ctx->blocks[block] = malloc(c->block_size)))
+		return NULL;
+	memcpy(ctx->blocks[block], base, c->block_size);
+
+	return ctx->blocks[block];
+}
+
+
 static int block_device_read(const struct lfs_config *c, lfs_block_t block,
 		lfs_off_t off, void *buffer, lfs_size_t size)
 {
@@ -89,11 +356,18 @@ static int block_device_read(const struct lfs_config *c, lfs_block_t block,
 		LFS_ERROR("attempt to read past end of block");
 		return LFS_ERR_IO;
 	}
-
-	if (ctx->fd >= 0) {
-		off_t f_offset = ctx->offset + (block * c->block_size) + off;
+	ctx->read_bytes += size;
+
+	if (ctx->cache) {
+		void *p;
+		int res = page_get(ctx, block, false, true, &p);
+		if (res)
+			return res;
+		memcpy(buffer, p + off, size);
+	} else if (ctx->fd >= 0) {
+		off_t f_offset = ctx->offset + ((off_t)block * c->block_size) + off;
 		if (lseek(ctx->fd, f_offset, SEEK_SET) < 0) {
-			LFS_ERROR("seek failed: %ld (errno=%d)", f_offset, errno);
+			LFS_ERROR("seek failed: %lld (errno=%d)", (long long)f_offset, errno);
 			return LFS_ERR_IO;
 		}
 		if (read_fd(ctx->fd, buffer, size) < size) {
@@ -101,7 +375,7 @@ static int block_device_read(const struct lfs_config *c, lfs_block_t block,
 			return LFS_ERR_IO;
 		}
 	} else {
-		memcpy(buffer, ctx->base + (block * c->block_size) + off, size);
+		memcpy(buffer, mem_block(ctx, block, false) + off, size);
 	}
 	return LFS_ERR_OK;
 }
@@ -127,11 +401,18 @@ static int block_device_prog(const struct lfs_config *c, lfs_block_t block,
 		LFS_ERROR("write must be within a block");
 		return LFS_ERR_IO;
 	}
-
-	if (ctx->fd >= 0) {
-		off_t f_offset = ctx->offset + (block * c->block_size) + off;
+	ctx->prog_bytes += size;
+
+	if (ctx->cache) {
+		void *p;
+		int res = page_get(ctx, block, true, true, &p);
+		if (res)
+			return res;
+		memcpy(p + off, buffer, size);
+	} else if (ctx->fd >= 0) {
+		off_t f_offset = ctx->offset + ((off_t)block * c->block_size) + off;
 		if (lseek(ctx->fd, f_offset, SEEK_SET) < 0) {
-			LFS_ERROR("seek failed: %ld", f_offset);
+			LFS_ERROR("seek failed: %lld", (long long)f_offset);
 			return LFS_ERR_IO;
 		}
 		if (write_fd(ctx->fd, buffer, size) < size) {
@@ -139,7 +420,12 @@ static int block_device_prog(const struct lfs_config *c, lfs_block_t block,
 			return LFS_ERR_IO;
 		}
 	} else {
-		memcpy(ctx->base + (block * c->block_size) + off, buffer, size);
+		void *p = mem_block(ctx, block, true);
+		if (!p)
+			return LFS_ERR_NOMEM;
+		memcpy(p + off, buffer, size);
+		if (ctx->dirty)
+			ctx->dirty[block / 32] |= (1U << (block % 32));
 	}
 
 	return LFS_ERR_OK;
@@ -148,8 +434,9 @@ static int block_device_prog(const struct lfs_config *c, lfs_block_t block,
 static int block_device_erase(const struct lfs_config *c, lfs_block_t block)
 {
 	struct lfs_context *ctx = (struct lfs_context*)c->context;
-	static void *null_buf = NULL;
-	static lfs_size_t null_buf_size = 0;
+	static void *erase_buf = NULL;
+	static lfs_size_t erase_buf_size = 0;
+	static uint8_t erase_buf_value = 0;
 
 
 	if (block >= c->block_count) {
@@ -157,26 +444,54 @@ static int block_device_erase(const struct lfs_config *c, lfs_block_t block)
 		return LFS_ERR_IO;
 	}
 
-	if (ctx->fd >= 0) {
-		if (null_buf_size != c->block_size) {
-			if (null_buf)
-				free(null_buf);
-			if (!(null_buf = calloc(1, c->block_size)))
+	/* Steer allocator to use consecutive blocks (within the allocation range),
+	   other blocks are reported as bad, so that littlefs allocates next block. */
+	if (ctx->alloc_next < ctx->alloc_end) {
+		if (block != ctx->alloc_next)
+			return LFS_ERR_CORRUPT;
+		ctx->alloc_next++;
+	}
+	ctx->erase_count++;
+
+	if (ctx->cache) {
+		void *p;
+		int res = page_get(ctx, block, true, false, &p);
+		if (res)
+			return res;
+		memset(p, ctx->erase_value, c->block_size);
+	} else if (ctx->fd >= 0) {
+		if (erase_buf_size != c->block_size) {
+			if (erase_buf)
+				free(erase_buf);
+			if (!(erase_buf = malloc(c->block_size))) {
+				erase_buf_size = 0;
 				return LFS_ERR_NOMEM;
-			null_buf_size = c->block_size;
+			}
+			erase_buf_size = c->block_size;
+			erase_buf_value = ctx->erase_value;
+			memset(erase_buf, erase_buf_value, erase_buf_size);
+		}
+		else if (erase_buf_value != ctx->erase_value) {
+			erase_buf_value = ctx->erase_value;
+			memset(erase_buf, erase_buf_value, erase_buf_size);
 		}
-		off_t f_offset = ctx->offset + (block * c->block_size);
+		off_t f_offset = ctx->offset + ((off_t)block * c->block_size);
 		if (lseek(ctx->fd, f_offset, SEEK_SET) < 0) {
-			LFS_ERROR("seek failed: %ld", f_offset);
+			LFS_ERROR("seek failed: %lld", (long long)f_offset);
 			return LFS_ERR_IO;
 		}
-		if (write_fd(ctx->fd, null_buf, null_buf_size) < null_buf_size) {
+		if (write_fd(ctx->fd, erase_buf, erase_buf_size) < erase_buf_size) {
 			LFS_ERROR("failed to write file");
 			return LFS_ERR_IO;
 		}
 	}
 	else {
-		memset(ctx->base + (block * c->block_size), 0, c->block_size);
+		void *p = mem_block(ctx, block, true);
+		if (!p)
+			return LFS_ERR_NOMEM;
+		memset(p, ctx->erase_value, c->block_size);
+		if (ctx->dirty)
+			ctx->dirty[block / 32] |= (1U << (block % 32));
 	}
 
 	return LFS_ERR_OK;
@@ -186,7 +501,8 @@ static int block_device_sync(const struct lfs_config *c)
 {
 	struct lfs_context *ctx = (struct lfs_context*)c->context;
 
-	if (ctx->fd >= 0) {
+	/* Paged context writes dirty blocks only when flushed (or evicted) */
+	if (ctx->fd >= 0 && !ctx->cache) {
 		if (fsync(ctx->fd)) {
 			LFS_ERROR("fsync() failed: %d", errno);
 			return LFS_ERR_IO;
@@ -246,6 +562,161 @@ static void init_lfs_config(struct lfs_config *cfg, size_t blocksize, size_t blo
 }
 
 
+/* Decode superblock from a metadata block (without mounting the filesystem).
+   Only tags from commits with valid CRC are used, and later commits
+   override earlier ones (like when superblock is updated by lfs_fs_grow). */
+int lfs_parse_superblock(const void *buf, size_t len, struct lfs_superblock_info *info)
+{
+	const uint8_t *p = buf;
+	uint32_t ptag = 0xffffffff;
+	uint32_t crc, tag, raw, val[6];
+	bool magic = false, sb = false;
+	bool pending_magic = false, pending_sb = false;
+	lfs_off_t off = 4;
+
+
+	if (!buf || !info || len < 16)
+		return -1;
+
+	memset(info, 0, sizeof(struct lfs_superblock_info));
+	memcpy(&raw, p, 4);
+	info->revision = lfs_fromle32(raw);
+	crc = lfs_crc(0xffffffff, p, 4);
+
+	while (off + 4 <= len) {
+		uint32_t type, size, dsize;
+
+		memcpy(&raw, p + off, 4);
+		tag = lfs_frombe32(raw) ^ ptag;
+		if (tag & 0x80000000)
+			break;
+		type = (tag >> 20) & 0x7ff;
+		size = tag & 0x3ff;
+		dsize = 4 + (size == 0x3ff ? 0 : size);
+		if (off + dsize > len)
+			break;
+		crc = lfs_crc(crc, &raw, 4);
+		ptag = tag;
+
+		if ((type & 0x780) == 0x500) {
+			/* CRC tag, ends a commit */
+			if (dsize < 8)
+				break;
+			memcpy(&raw, p + off + 4, 4);
+			if (crc != lfs_fromle32(raw))
+				break;
+			ptag ^= (uint32_t)(type & 0x01) << 31;
+			crc = 0xffffffff;
+			magic |= pending_magic;
+			if (pending_sb) {
+				info->version = val[0];
+				info->block_size = val[1];
+				info->block_count = val[2];
+				info->name_max = val[3];
+				info->file_max = val[4];
+				info->attr_max = val[5];
+				sb = true;
+				/* Rest of the data is beyond this block */
+				if (info->block_size >= 16 && info->block_size < len)
+					len = info->block_size;
+			}
+			pending_magic = pending_sb = false;
+		}
+		else {
+			crc = lfs_crc(crc, p + off + 4, dsize - 4);
+			if (type == 0x0ff && size == 8 && !memcmp(p + off + 4, "littlefs", 8))
+				pending_magic = true;
+			if (type == 0x201 && ((tag >> 10) & 0x3ff) == 0 && size >= 24) {
+				for (int i = 0; i < 6; i++) {
+					memcpy(&raw, p + off + 4 + i * 4, 4);
+					val[i] = lfs_fromle32(raw);
+				}
+				pending_sb = true;
+			}
+		}
+		off += dsize;
+	}
+
+	if (!magic || !sb || info->block_size < 128 || info->block_count < 2
+		|| (info->version >> 16) != 2)
+		return -2;
+
+	return 0;
+}
+
+
+static int read_image(struct lfs_context *ctx, off_t offset, void *buf, size_t len)
+{
+	if (ctx->fd >= 0) {
+		if (lseek(ctx->fd, ctx->offset + offset, SEEK_SET) < 0)
+			return -1;
+		if (read_fd(ctx->fd, buf, len) < (ssize_t)len)
+			return -2;
+	} else {
+		memcpy(buf, ctx->base + offset, len);
+	}
+
+	return 0;
+}
+
+
+/* Find and decode superblock from the first two blocks of the image
+   (superblock pair), without mounting the filesystem. Block 0 is always at
+   the start of the image, block 1 is located by trying candidate block sizes,
+   if block 0 does not contain a valid superblock. */
+int lfs_probe(struct lfs_context *ctx, size_t size, struct lfs_superblock_info *info)
+{
+	struct lfs_superblock_info sb;
+	lfs_size_t candidates[16];
+	int count = 0;
+	bool found = false;
+	uint8_t *buf;
+	size_t len;
+
+
+	if (!ctx || !info || size < PROBE_MIN_BLOCK_SIZE)
+		return LFS_ERR_INVAL;
+
+	len = (size < PROBE_MAX_BLOCK_SIZE ? size : PROBE_MAX_BLOCK_SIZE);
+	if (!(buf = malloc(len)))
+		return LFS_ERR_NOMEM;
+
+	if (read_image(ctx, 0, buf, len) == 0 && lfs_parse_superblock(buf, len, &sb) == 0) {
+		*info = sb;
+		found = true;
+		candidates[count++] = sb.block_size;
+	} else {
+		candidates[count++] = ctx->cfg.block_size;
+		for (lfs_size_t bs = PROBE_MIN_BLOCK_SIZE; bs <= PROBE_MAX_BLOCK_SIZE; bs *= 2) {
+			if (bs != ctx->cfg.block_size)
+				candidates[count++] = bs;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		lfs_size_t bs = candidates[i];
+
+		if (bs + PROBE_MIN_BLOCK_SIZE > size)
+			continue;
+		len = (size - bs < bs ? size - bs : bs);
+		if (len > PROBE_MAX_BLOCK_SIZE)
+			len = PROBE_MAX_BLOCK_SIZE;
+		if (read_image(ctx, bs, buf, len) || lfs_parse_superblock(buf, len, &sb))
+			continue;
+		if (sb.block_size != bs)
+			continue;
+		/* Use newer copy of the superblock */
+		if (!found || lfs_scmp(sb.revision, info->revision) > 0)
+			*info = sb;
+		found = true;
+		break;
+	}
+	free(buf);
+
+	return (found ? LFS_ERR_OK : LFS_ERR_CORRUPT);
+}
+
+
 struct lfs_context* lfs_init_mem(void *base, size_t size, size_t blocksize)
 {
 	if (!base || blocksize < 1)
@@ -275,7 +746,7 @@ struct lfs_context* lfs_init_mem(void *base, size_t size, size_t blocksize)
 }
 
 
-struct lfs_context* lfs_init_file(int fd, size_t offset, size_t size, size_t blocksize)
+struct lfs_context* lfs_init_file(int fd, off_t offset, size_t size, size_t blocksize)
 {
 	if (fd < 0 || blocksize < 1) {
 		LFS_ERROR("invalid arguments");
@@ -292,7 +763,7 @@ struct lfs_context* lfs_init_file(int fd, size_t offset, size_t size, size_t blo
 		LFS_ERROR("failed to stat file");
 		return NULL;
 	}
-	if ((off_t)(offset + size) > st.st_size) {
+	if (offset < 0 || offset + (off_t)size > st.st_size) {
 		LFS_ERROR("file too small");
 		return NULL;
 	}
@@ -306,12 +777,166 @@ struct lfs_context* lfs_init_file(int fd, size_t offset, size_t size, size_t blo
 	ctx->fd = fd;
 	ctx->base = NULL;
 	ctx->offset = offset;
+#ifdef LFS_THREADSAFE
+	pthread_mutex_init(&ctx->mutex, NULL);
+#endif
 
 	init_lfs_config(&ctx->cfg, blocksize, size / blocksize, ctx);
 
 	return ctx;
 }
 
+struct lfs_context* lfs_init_paged(int fd, off_t offset, size_t size, size_t blocksize,
+		size_t max_memory, bool huge_pages)
+{
+	struct lfs_context *ctx = lfs_init_file(fd, offset, size, blocksize);
+
+	if (!ctx)
+		return NULL;
+
+	if (!(ctx->cache = calloc(1, sizeof(struct lfs_page_cache)))) {
+		LFS_ERROR("out of memory");
+		lfs_destroy_context(ctx);
+		return NULL;
+	}
+	ctx->cache->max_memory = max_memory;
+	ctx->cache->huge_pages = huge_pages;
+
+	return ctx;
+}
+
+int lfs_flush(struct lfs_context *ctx)
+{
+	struct lfs_page_cache *pc;
+	int res;
+
+	if (!ctx)
+		return -1;
+	if (!(pc = ctx->cache))
+		return 0;
+
+	for (lfs_size_t i = 0; i < pc->size; i++) {
+		if (pc->pages[i] && (pc->flags[i] & PAGE_DIRTY)) {
+			if ((res = page_write(ctx, i)))
+				return res;
+		}
+	}
+
+	return 0;
+}
+
+struct lfs_context* lfs_init_cow(const void *base, size_t size, size_t blocksize)
+{
+	struct lfs_context *ctx = lfs_init_mem((void*)base, size, blocksize);
+
+	if (!ctx)
+		return NULL;
+
+	if (!(ctx->blocks = calloc(ctx->cfg.block_count, sizeof(void*)))) {
+		LFS_ERROR("out of memory");
+		lfs_destroy_context(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+int lfs_write_image(struct lfs_context *ctx, int fd, off_t offset)
+{
+	const struct lfs_config *c;
+	lfs_block_t block = 0;
+
+	if (!ctx || !ctx->base || fd < 0)
+		return -1;
+
+	c = &ctx->cfg;
+	if (lseek(fd, offset, SEEK_SET) < 0) {
+		LFS_ERROR("seek failed: %lld", (long long)offset);
+		return -2;
+	}
+
+	while (block < c->block_count) {
+		lfs_block_t count = 1;
+		void *p = mem_block(ctx, block, false);
+
+		/* Write consecutive blocks from the same buffer with single write */
+		if (!ctx->blocks || !ctx->blocks[block]) {
+			while (block + count < c->block_count
+				&& (!ctx->blocks || !ctx->blocks[block + count]))
+				count++;
+		}
+		if (write_fd(fd, p, (size_t)count * c->block_size)
+			< (ssize_t)((size_t)count * c->block_size)) {
+			LFS_ERROR("failed to write file");
+			return -3;
+		}
+		block += count;
+	}
+
+	return 0;
+}
+
+/* Start tracking blocks modified in memory context */
+int lfs_track_dirty(struct lfs_context *ctx)
+{
+	if (!ctx || ctx->fd >= 0 || !ctx->base || ctx->blocks)
+		return -1;
+
+	free(ctx->dirty);
+	if (!(ctx->dirty = calloc((ctx->cfg.block_count + 31) / 32, sizeof(uint32_t)))) {
+		LFS_ERROR("out of memory");
+		return -2;
+	}
+
+	return 0;
+}
+
+/* Write blocks modified since last call to the image file */
+int lfs_write_dirty(struct lfs_context *ctx, int fd, off_t offset)
+{
+	const struct lfs_config *c;
+	lfs_block_t block = 0;
+
+	if (!ctx || !ctx->dirty || fd < 0)
+		return -1;
+
+	c = &ctx->cfg;
+	while (block < c->block_count) {
+		lfs_block_t count = 0;
+		off_t f_offset;
+		size_t len;
+
+		if (!ctx->dirty[block / 32]) {
+			block = (block / 32 + 1) * 32;
+			continue;
+		}
+		/* Write consecutive modified blocks with single write */
+		while (block + count < c->block_count
+			&& (ctx->dirty[(block + count) / 32] & (1U << ((block + count) % 32))))
+			count++;
+		if (count == 0) {
+			block++;
+			continue;
+		}
+
+		f_offset = offset + (off_t)block * c->block_size;
+		len = (size_t)count * c->block_size;
+		if (lseek(fd, f_offset, SEEK_SET) < 0) {
+			LFS_ERROR("seek failed: %lld", (long long)f_offset);
+			return -2;
+		}
+		if (write_fd(fd, mem_block(ctx, block, false), len) < (ssize_t)len) {
+			LFS_ERROR("failed to write file");
+			return -3;
+		}
+		for (lfs_block_t i = block; i < block + count; i++)
+			ctx->dirty[i / 32] &= ~(1U << (i % 32));
+		block += count;
+	}
+
+	return 0;
+}
+
 int lfs_change_blocksize(struct lfs_context *ctx, size_t size, size_t blocksize)
 {
 	if (!ctx || blocksize < 1)
@@ -322,6 +947,13 @@ int lfs_change_blocksize(struct lfs_context *ctx, size_t size, size_t blocksize)
 		return -2;
 	}
 
+	/* Cached blocks are no longer valid with the new blocksize */
+	if (ctx->cache) {
+		if (lfs_flush(ctx))
+			return -3;
+		page_drop_all(ctx);
+	}
+
 	ctx->cfg.prog_size = blocksize;
 	ctx->cfg.block_size = blocksize;
 	ctx->cfg.cache_size = blocksize;
@@ -329,11 +961,85 @@ int lfs_change_blocksize(struct lfs_context *ctx, size_t size, size_t blocksize)
 	return 0;
 }
 
+int lfs_resize_mem(struct lfs_context *ctx, size_t size)
+{
+	size_t old_size;
+	void *base;
+
+	if (!ctx || ctx->fd >= 0 || !ctx->base || ctx->blocks || ctx->dirty)
+		return -1;
+
+	if (size % ctx->cfg.block_size != 0) {
+		LFS_ERROR("image size not multiple of blocksize");
+		return -2;
+	}
+
+	old_size = (size_t)ctx->cfg.block_count * ctx->cfg.block_size;
+	if (!(base = realloc(ctx->base, size))) {
+		LFS_ERROR("out of memory");
+		return -3;
+	}
+	if (size > old_size)
+		memset(base + old_size, ctx->erase_value, size - old_size);
+
+	ctx->base = base;
+	ctx->cfg.block_count = size / ctx->cfg.block_size;
+
+	return 0;
+}
+
+int lfs_set_erase_value(struct lfs_context *ctx, uint8_t value)
+{
+	if (!ctx)
+		return -1;
+
+	ctx->erase_value = value;
+
+	return 0;
+}
+
+int lfs_set_alloc_range(struct lfs_context *ctx, lfs_block_t start, lfs_size_t count)
+{
+	if (!ctx)
+		return -1;
+
+	if (count > 0 && (start >= ctx->cfg.block_count
+				|| count > ctx->cfg.block_count - start)) {
+		LFS_ERROR("invalid allocation range");
+		return -2;
+	}
+
+	ctx->alloc_next = start;
+	ctx->alloc_end = start + count;
+
+	return 0;
+}
+
+void lfs_reset_stats(struct lfs_context *ctx)
+{
+	if (!ctx)
+		return;
+
+	ctx->read_bytes = 0;
+	ctx->prog_bytes = 0;
+	ctx->erase_count = 0;
+}
+
 void lfs_destroy_context(struct lfs_context *ctx)
 {
 	if (!ctx)
 		return;
 
+	if (ctx->blocks) {
+		for (lfs_block_t i = 0; i < ctx->cfg.block_count; i++)
+			free(ctx->blocks[i]);
+		free(ctx->blocks);
+	}
+	free(ctx->dirty);
+	if (ctx->cache) {
+		page_drop_all(ctx);
+		free(ctx->cache);
+	}
 #ifdef LFS_THREADSAFE
 	pthread_mutex_destroy(&ctx->mutex);
 #endif
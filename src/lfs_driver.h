@@ -22,6 +22,7 @@
 #ifndef _LFS_DRIVER_H_
 #define _LFS_DRIVER_H_
 
+#include <sys/types.h>
 #ifdef LFS_THREADSAFE
 #include <pthread.h>
 #endif
@@ -33,20 +34,54 @@ extern "C"
 #endif
 
 
+struct lfs_page_cache;
+
 struct lfs_context {
 	struct lfs_config cfg;
 	int fd;
 	void *base;
-	size_t offset;
+	void **blocks;
+	uint32_t *dirty;
+	struct lfs_page_cache *cache;
+	off_t offset;
+	uint64_t read_bytes;
+	uint64_t prog_bytes;
+	uint64_t erase_count;
+	lfs_block_t alloc_next;
+	lfs_block_t alloc_end;
+	uint8_t erase_value;
 #ifdef LFS_THREADSAFE
 	pthread_mutex_t mutex;
 #endif
 };
 
+struct lfs_superblock_info {
+	uint32_t revision;
+	uint32_t version;
+	lfs_size_t block_size;
+	lfs_size_t block_count;
+	lfs_size_t name_max;
+	lfs_size_t file_max;
+	lfs_size_t attr_max;
+};
+
 
+int lfs_parse_superblock(const void *buf, size_t len, struct lfs_superblock_info *info);
+int lfs_probe(struct lfs_context *ctx, size_t size, struct lfs_superblock_info *info);
 struct lfs_context* lfs_init_mem(void *base, size_t size, size_t blocksize);
-struct lfs_context* lfs_init_file(int fd, size_t offset, size_t size, size_t blocksize);
+struct lfs_context* lfs_init_file(int fd, off_t offset, size_t size, size_t blocksize);
+struct lfs_context* lfs_init_paged(int fd, off_t offset, size_t size, size_t blocksize,
+		size_t max_memory, bool huge_pages);
+int lfs_flush(struct lfs_context *ctx);
+struct lfs_context* lfs_init_cow(const void *base, size_t size, size_t blocksize);
+int lfs_write_image(struct lfs_context *ctx, int fd, off_t offset);
+int lfs_track_dirty(struct lfs_context *ctx);
+int lfs_write_dirty(struct lfs_context *ctx, int fd, off_t offset);
 int lfs_change_blocksize(struct lfs_context *ctx, size_t size, size_t blocksize);
+int lfs_resize_mem(struct lfs_context *ctx, size_t size);
+int lfs_set_erase_value(struct lfs_context *ctx, uint8_t value);
+int lfs_set_alloc_range(struct lfs_context *ctx, lfs_block_t start, lfs_size_t count);
+void lfs_reset_stats(struct lfs_context *ctx);
 void lfs_destroy_context(struct lfs_context *ctx);
 
 
@@ -23,6 +23,7 @@
 #include "config.h"
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <lfs.h>
 #include <lfs_util.h>
@@ -121,3 +122,228 @@ int lfs_rmdir_recursive(lfs_t *lfs, const char *pathname)
 }
 
 
+/* Count directory levels in the path that do not exist (yet) */
+int lfs_missing_dirs(lfs_t *lfs, const char *pathname)
+{
+	struct lfs_info st;
+	char *path, *p;
+	int count = 0;
+
+
+	if (!(path = strdup(pathname)))
+		return LFS_ERR_NOMEM;
+
+	/* Walk up from the full path until an existing directory is found */
+	while (1) {
+		size_t len = strlen(path);
+
+		while (len > 0 && path[len - 1] == '/')
+			path[--len] = 0;
+		if (len == 0 || !strcmp(path, "."))
+			break;
+		if (lfs_stat(lfs, path, &st) == LFS_ERR_OK)
+			break;
+		count++;
+		if ((p = strrchr(path, '/')))
+			*p = 0;
+		else
+			*path = 0;
+	}
+	free(path);
+
+	return count;
+}
+
+
+/* Remove custom attribute from a file (if the attribute is present) */
+int lfs_clear_attr(lfs_t *lfs, const char *pathname, uint8_t type)
+{
+	lfs_ssize_t res;
+
+	/* Check first, to avoid metadata commit when there is nothing to remove */
+	if ((res = lfs_getattr(lfs, pathname, type, NULL, 0)) == LFS_ERR_NOATTR)
+		return LFS_ERR_OK;
+	if (res < 0)
+		return res;
+
+	return lfs_removeattr(lfs, pathname, type);
+}
+
+
+static int highest_block_cb(void *data, lfs_block_t block)
+{
+	lfs_block_t *highest = (lfs_block_t*)data;
+
+	if (block > *highest)
+		*highest = block;
+
+	return 0;
+}
+
+
+int lfs_fs_highest_block(lfs_t *lfs, lfs_block_t *block)
+{
+	if (!lfs || !block)
+		return LFS_ERR_INVAL;
+
+	*block = 0;
+
+	return lfs_fs_traverse(lfs, highest_block_cb, block);
+}
+
+
+struct block_bitmap {
+	uint32_t *map;
+	lfs_size_t count;
+};
+
+static int block_bitmap_cb(void *data, lfs_block_t block)
+{
+	struct block_bitmap *bm = (struct block_bitmap*)data;
+
+	if (block < bm->count)
+		bm->map[block / 32] |= (1U << (block % 32));
+
+	return 0;
+}
+
+
+uint32_t* lfs_fs_block_bitmap(lfs_t *lfs)
+{
+	struct block_bitmap bm;
+
+	if (!lfs)
+		return NULL;
+
+	bm.count = lfs->block_count;
+	if (!(bm.map = calloc((bm.count + 31) / 32, sizeof(uint32_t))))
+		return NULL;
+	if (lfs_fs_traverse(lfs, block_bitmap_cb, &bm) != LFS_ERR_OK) {
+		free(bm.map);
+		return NULL;
+	}
+
+	return bm.map;
+}
+
+
+int lfs_fs_find_free_run(lfs_t *lfs, lfs_size_t count, lfs_block_t *start)
+{
+	uint32_t *map;
+	lfs_size_t run = 0;
+	int res = LFS_ERR_NOSPC;
+
+	if (!lfs || !start || count < 1)
+		return LFS_ERR_INVAL;
+	if (!(map = lfs_fs_block_bitmap(lfs)))
+		return LFS_ERR_NOMEM;
+
+	for (lfs_block_t b = 0; b < lfs->block_count; b++) {
+		if (map[b / 32] & (1U << (b % 32))) {
+			run = 0;
+			continue;
+		}
+		if (++run == count) {
+			*start = b - count + 1;
+			res = LFS_ERR_OK;
+			break;
+		}
+	}
+	free(map);
+
+	return res;
+}
+
+
+/* Same as lfs_ctz_index() in lfs.c: return index of the block (in CTZ skip-list)
+   containing given file offset, and update offset to be offset within the block. */
+static lfs_size_t ctz_index(lfs_size_t block_size, lfs_off_t *off)
+{
+	lfs_off_t size = *off;
+	lfs_off_t b = block_size - 2 * 4;
+	lfs_off_t i = size / b;
+
+	if (i == 0)
+		return 0;
+
+	i = (size - 4 * (lfs_popc(i - 1) + 2)) / b;
+	*off = size - b * i - 4 * lfs_popc(i);
+
+	return i;
+}
+
+
+lfs_size_t lfs_ctz_blocks(lfs_t *lfs, lfs_size_t size)
+{
+	lfs_off_t off = size - 1;
+
+	if (!lfs || size < 1)
+		return 0;
+
+	return ctz_index(lfs->cfg->block_size, &off) + 1;
+}
+
+
+int lfs_file_extents(lfs_t *lfs, const char *pathname, struct lfs_extent **extents,
+		lfs_size_t *count)
+{
+	lfs_file_t file;
+	lfs_block_t block;
+	lfs_size_t block_size, size, i;
+	lfs_off_t off;
+	int res = LFS_ERR_OK;
+
+
+	if (!lfs || !pathname || !extents || !count)
+		return LFS_ERR_INVAL;
+
+	*extents = NULL;
+	*count = 0;
+
+	if ((res = lfs_file_open(lfs, &file, pathname, LFS_O_RDONLY)) != LFS_ERR_OK)
+		return res;
+
+	block = file.ctz.head;
+	size = file.ctz.size;
+	if ((file.flags & LFS_F_INLINE) || size == 0) {
+		/* Inlined files have no blocks of their own */
+		lfs_file_close(lfs, &file);
+		return LFS_ERR_OK;
+	}
+	lfs_file_close(lfs, &file);
+
+	block_size = lfs->cfg->block_size;
+	off = size - 1;
+	i = ctz_index(block_size, &off);
+	if (!(*extents = calloc(i + 1, sizeof(struct lfs_extent))))
+		return LFS_ERR_NOMEM;
+	*count = i + 1;
+
+	/* Walk the skip-list backwards from the head block */
+	while (1) {
+		struct lfs_extent *e = &(*extents)[i];
+
+		e->block = block;
+		e->off = (i > 0 ? 4 * (lfs_ctz(i) + 1) : 0);
+		if (i == *count - 1) {
+			/* Last block holds the remainder of the file */
+			e->size = off + 1 - e->off;
+		} else {
+			e->size = block_size - e->off;
+		}
+		if (i == 0)
+			break;
+
+		/* First pointer in a block points to the previous block */
+		if ((res = lfs->cfg->read(lfs->cfg, block, 0, &block, sizeof(block)))) {
+			free(*extents);
+			*extents = NULL;
+			*count = 0;
+			break;
+		}
+		block = lfs_fromle32(block);
+		i--;
+	}
+
+	return res;
+}
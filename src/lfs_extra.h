@@ -29,9 +29,27 @@ extern "C"
 {
 #endif
 
+/* Custom attribute where lfst caches size and CRC of file content */
+#define LFST_ATTR_CRC 0x43
+
+
+struct lfs_extent {
+	lfs_block_t block;
+	lfs_off_t off;
+	lfs_size_t size;
+};
+
 
 int lfs_mkdir_parent(lfs_t *lfs, const char *pathname);
 int lfs_rmdir_recursive(lfs_t *lfs, const char *pathname);
+int lfs_missing_dirs(lfs_t *lfs, const char *pathname);
+int lfs_clear_attr(lfs_t *lfs, const char *pathname, uint8_t type);
+int lfs_fs_highest_block(lfs_t *lfs, lfs_block_t *block);
+uint32_t* lfs_fs_block_bitmap(lfs_t *lfs);
+int lfs_fs_find_free_run(lfs_t *lfs, lfs_size_t count, lfs_block_t *start);
+lfs_size_t lfs_ctz_blocks(lfs_t *lfs, lfs_size_t size);
+int lfs_file_extents(lfs_t *lfs, const char *pathname, struct lfs_extent **extents,
+		lfs_size_t *count);
 
 
 
@@ -0,0 +1,231 @@
+/* lfs_index.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lfs.h>
+#include <lfs_util.h>
+
+#include "lfs_extra.h"
+#include "lfs_index.h"
+#include "littlefs-toy.h"
+
+
+struct index_buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct path_list {
+	char **paths;
+	size_t count;
+	size_t alloc;
+};
+
+
+static int buf_append(struct index_buf *b, const void *data, size_t len)
+{
+	if (b->len + len > b->alloc) {
+		size_t alloc = (b->alloc ? b->alloc : 4096);
+		uint8_t *p;
+
+		while (alloc < b->len + len)
+			alloc *= 2;
+		if (!(p = realloc(b->data, alloc)))
+			return -1;
+		b->data = p;
+		b->alloc = alloc;
+	}
+	if (data)
+		memcpy(b->data + b->len, data, len);
+	else
+		memset(b->data + b->len, 0, len);
+	b->len += len;
+
+	return 0;
+}
+
+static int buf_append_u16(struct index_buf *b, uint16_t val)
+{
+	uint8_t d[2] = { val & 0xff, (val >> 8) & 0xff };
+
+	return buf_append(b, d, sizeof(d));
+}
+
+static int buf_append_u32(struct index_buf *b, uint32_t val)
+{
+	val = lfs_tole32(val);
+
+	return buf_append(b, &val, sizeof(val));
+}
+
+static void buf_put_u32(struct index_buf *b, size_t pos, uint32_t val)
+{
+	val = lfs_tole32(val);
+	memcpy(b->data + pos, &val, sizeof(val));
+}
+
+
+static int collect_files(lfs_t *lfs, const char *path, struct path_list *list,
+		lfs_index_filter_t filter, void *arg)
+{
+	lfs_dir_t dir;
+	struct lfs_info info;
+	char fullname[LFS_NAME_MAX * 2];
+	int res;
+
+	if ((res = lfs_dir_open(lfs, &dir, path)) != LFS_ERR_OK)
+		return res;
+
+	while ((res = lfs_dir_read(lfs, &dir, &info)) > 0) {
+		/* Skip special directories ("." and "..") */
+		if (info.name[0] == '.') {
+			if (info.name[1] == 0)
+				continue;
+			if (info.name[1] == '.' && info.name[2] == 0)
+				continue;
+		}
+
+		snprintf(fullname, sizeof(fullname), "%s%s%s", path,
+			(path[strlen(path) - 1] == '/' ? "" : "/"), info.name);
+		fullname[LFS_NAME_MAX] = 0;
+
+		if (info.type == LFS_TYPE_DIR) {
+			if ((res = collect_files(lfs, fullname, list, filter, arg)))
+				break;
+			continue;
+		}
+		if (filter && !filter(fullname + 1, arg))
+			continue;
+
+		if (list->count >= list->alloc) {
+			size_t alloc = (list->alloc ? list->alloc * 2 : 64);
+			char **p;
+
+			if (!(p = realloc(list->paths, alloc * sizeof(char*)))) {
+				res = LFS_ERR_NOMEM;
+				break;
+			}
+			list->paths = p;
+			list->alloc = alloc;
+		}
+		if (!(list->paths[list->count] = strdup(fullname + 1))) {
+			res = LFS_ERR_NOMEM;
+			break;
+		}
+		list->count++;
+	}
+	lfs_dir_close(lfs, &dir);
+
+	return (res < 0 ? res : 0);
+}
+
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+int lfs_write_extent_index(lfs_t *lfs, int fd, uint64_t base_offset,
+		lfs_index_filter_t filter, void *arg)
+{
+	struct path_list list = { NULL, 0, 0 };
+	struct index_buf b = { NULL, 0, 0 };
+	struct lfs_extent *extents;
+	struct lfs_info info;
+	lfs_size_t count;
+	uint32_t crc;
+	int res;
+
+
+	if (!lfs || fd < 0)
+		return LFS_ERR_INVAL;
+
+	/* Collect (and sort) paths of the files to include in the index */
+	if ((res = collect_files(lfs, "/", &list, filter, arg)) == 0)
+		qsort(list.paths, list.count, sizeof(char*), compare_paths);
+
+	/* Header */
+	if (res == 0) {
+		if (buf_append_u32(&b, LFS_INDEX_MAGIC)
+			|| buf_append_u16(&b, LFS_INDEX_VERSION)
+			|| buf_append_u16(&b, 32)
+			|| buf_append_u32(&b, lfs->cfg->block_size)
+			|| buf_append_u32(&b, lfs->block_count)
+			|| buf_append_u32(&b, base_offset & 0xffffffff)
+			|| buf_append_u32(&b, base_offset >> 32)
+			|| buf_append_u32(&b, list.count)
+			|| buf_append_u32(&b, 0))
+			res = LFS_ERR_NOMEM;
+	}
+
+	/* Entries */
+	for (size_t i = 0; i < list.count && res == 0; i++) {
+		const char *path = list.paths[i];
+		size_t path_len = strlen(path);
+
+		if ((res = lfs_stat(lfs, path, &info)) != LFS_ERR_OK)
+			break;
+		if ((res = lfs_file_extents(lfs, path, &extents, &count)) != LFS_ERR_OK)
+			break;
+
+		if (buf_append_u16(&b, path_len)
+			|| buf_append_u16(&b, (count == 0 && info.size > 0 ? LFS_INDEX_F_INLINE : 0))
+			|| buf_append_u32(&b, info.size)
+			|| buf_append_u32(&b, count)
+			|| buf_append(&b, path, path_len)
+			|| buf_append(&b, NULL, (4 - (path_len % 4)) % 4))
+			res = LFS_ERR_NOMEM;
+		for (lfs_size_t j = 0; j < count && res == 0; j++) {
+			if (buf_append_u32(&b, extents[j].block)
+				|| buf_append_u32(&b, extents[j].off)
+				|| buf_append_u32(&b, extents[j].size))
+				res = LFS_ERR_NOMEM;
+		}
+		free(extents);
+	}
+
+	/* Total size and CRC */
+	if (res == 0) {
+		buf_put_u32(&b, 28, b.len + sizeof(uint32_t));
+		crc = lfs_crc(0xffffffff, b.data, b.len);
+		if (buf_append_u32(&b, crc))
+			res = LFS_ERR_NOMEM;
+	}
+
+	if (res == 0) {
+		if (write_file(fd, 0, b.data, b.len))
+			res = LFS_ERR_IO;
+	}
+
+	for (size_t i = 0; i < list.count; i++)
+		free(list.paths[i]);
+	free(list.paths);
+	free(b.data);
+
+	return res;
+}
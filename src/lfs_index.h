@@ -0,0 +1,77 @@
+/* lfs_index.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LFS_INDEX_H_
+#define _LFS_INDEX_H_
+
+#include <stdint.h>
+#include <lfs.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/*
+ * File extent index format (all values are little-endian):
+ *
+ *   header:
+ *     uint32_t magic;          "LFSX"
+ *     uint16_t version;        1
+ *     uint16_t header_size;    32
+ *     uint32_t block_size;
+ *     uint32_t block_count;
+ *     uint64_t base_offset;    offset of the filesystem (in flash/image)
+ *     uint32_t entry_count;
+ *     uint32_t index_size;     total size of the index (including CRC)
+ *
+ *   entries (sorted by path):
+ *     uint16_t path_len;
+ *     uint16_t flags;          LFS_INDEX_F_INLINE if file is stored in metadata
+ *     uint32_t file_size;
+ *     uint32_t extent_count;
+ *     char     path[];         padded with zeros to multiple of 4 bytes
+ *     extents[extent_count]:
+ *       uint32_t block;
+ *       uint32_t offset;       offset of file data within the block
+ *       uint32_t size;         bytes of file data in the block
+ *
+ *   uint32_t crc;              CRC-32 (as used by littlefs) of all preceding bytes
+ */
+
+#define LFS_INDEX_MAGIC 0x5853464c /* "LFSX" */
+#define LFS_INDEX_VERSION 1
+#define LFS_INDEX_F_INLINE 0x0001
+
+
+typedef int (*lfs_index_filter_t)(const char *pathname, void *arg);
+
+int lfs_write_extent_index(lfs_t *lfs, int fd, uint64_t base_offset,
+		lfs_index_filter_t filter, void *arg);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _LFS_INDEX_H_ */
@@ -0,0 +1,658 @@
+/* lfs_tar.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Import files from a tar stream (ustar, pax, or GNU format) directly into
+ * a LittleFS filesystem, without extracting them to the host filesystem.
+ *
+ * Reader thread parses the stream and queues entries (with file data)
+ * ahead of the writer, which adds queued entries to the filesystem in order.
+ *
+ * Files can also be exported from the filesystem as a ustar stream (using
+ * pax extended headers for names that don't fit in ustar header).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <lfs.h>
+#include <lfs_util.h>
+
+#include "lfs_extra.h"
+#include "lfs_tar.h"
+#include "littlefs-toy.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_INFLIGHT (64 * 1024 * 1024)
+#define TAR_MAX_HEADER_DATA (1024 * 1024)
+#define TAR_COPY_BUF_SIZE (64 * 1024)
+
+
+struct tar_entry {
+	char *name;
+	bool dir;
+	size_t size;
+	void *data;
+	struct tar_entry *next;
+};
+
+struct tar_reader {
+	int fd;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct tar_entry *head;
+	struct tar_entry *tail;
+	size_t inflight;
+	bool done;
+	bool abort;
+	int error;
+};
+
+
+static uint64_t parse_number(const uint8_t *s, size_t len)
+{
+	uint64_t val = 0;
+
+	/* GNU base-256 encoding (for large values) */
+	if (s[0] & 0x80) {
+		val = s[0] & 0x3f;
+		for (size_t i = 1; i < len; i++)
+			val = (val << 8) | s[i];
+		return val;
+	}
+
+	while (len > 0 && *s == ' ') {
+		s++;
+		len--;
+	}
+	while (len > 0 && *s >= '0' && *s <= '7') {
+		val = (val << 3) + (*s - '0');
+		s++;
+		len--;
+	}
+
+	return val;
+}
+
+
+static bool valid_header(const uint8_t *h)
+{
+	uint64_t sum = 0;
+
+	/* Checksum field itself is counted as spaces */
+	for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+		sum += (i >= 148 && i < 156 ? ' ' : h[i]);
+
+	return (sum == parse_number(h + 148, 8));
+}
+
+
+static int skip_data(int fd, uint64_t size)
+{
+	uint8_t buf[TAR_BLOCK_SIZE * 16];
+
+	while (size > 0) {
+		size_t len = (size > sizeof(buf) ? sizeof(buf) : size);
+
+		if (read_file(fd, -1, buf, len))
+			return -1;
+		size -= len;
+	}
+
+	return 0;
+}
+
+
+static uint64_t padding(uint64_t size)
+{
+	return (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+}
+
+
+/* Read data of pax extended header or GNU long name */
+static char* read_header_data(int fd, uint64_t size)
+{
+	char *buf;
+
+	if (size > TAR_MAX_HEADER_DATA)
+		return NULL;
+	if (!(buf = malloc(size + 1)))
+		return NULL;
+	if (read_file(fd, -1, buf, size) || skip_data(fd, padding(size))) {
+		free(buf);
+		return NULL;
+	}
+	buf[size] = 0;
+
+	return buf;
+}
+
+
+static int parse_pax(const char *buf, size_t size, char **path, uint64_t *filesize)
+{
+	const char *p = buf;
+	const char *end = buf + size;
+
+	/* Records are in format: "<length> <key>=<value>\n" */
+	while (p < end) {
+		char *key;
+		unsigned long len = strtoul(p, &key, 10);
+
+		if (len == 0 || len > (size_t)(end - p) || *key != ' ' || p[len - 1] != '\n')
+			return -1;
+		key++;
+		if (!strncmp(key, "path=", 5)) {
+			free(*path);
+			if (!(*path = strndup(key + 5, (p + len - 1) - (key + 5))))
+				return -2;
+		}
+		else if (!strncmp(key, "size=", 5)) {
+			*filesize = strtoull(key + 5, NULL, 10);
+		}
+		p += len;
+	}
+
+	return 0;
+}
+
+
+static char* entry_name(const uint8_t *h, const char *longname)
+{
+	char name[256 + 156];
+	char *s;
+	size_t len;
+
+	if (longname) {
+		s = (char*)longname;
+	} else {
+		/* POSIX ustar header may have prefix for the name */
+		if (!memcmp(h + 257, "ustar", 6) && h[345])
+			snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+		else
+			snprintf(name, sizeof(name), "%.100s", h);
+		s = name;
+	}
+
+	/* Names are relative to root of the filesystem */
+	while (*s == '/' || (s[0] == '.' && s[1] == '/')) {
+		s += (*s == '/' ? 1 : 2);
+	}
+	if (!(s = strdup(s)))
+		return NULL;
+	len = strlen(s);
+	while (len > 0 && s[len - 1] == '/')
+		s[--len] = 0;
+
+	return s;
+}
+
+
+static bool reader_aborted(struct tar_reader *r)
+{
+	bool abort;
+
+	pthread_mutex_lock(&r->mutex);
+	abort = r->abort;
+	pthread_mutex_unlock(&r->mutex);
+
+	return abort;
+}
+
+
+/* Wait until there is room for more data to be queued */
+static bool reserve_inflight(struct tar_reader *r, size_t size)
+{
+	bool abort;
+
+	pthread_mutex_lock(&r->mutex);
+	while (!r->abort && r->inflight > 0 && r->inflight + size > TAR_MAX_INFLIGHT)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	r->inflight += size;
+	abort = r->abort;
+	pthread_mutex_unlock(&r->mutex);
+
+	return !abort;
+}
+
+
+static void queue_entry(struct tar_reader *r, struct tar_entry *e)
+{
+	pthread_mutex_lock(&r->mutex);
+	if (r->tail)
+		r->tail->next = e;
+	else
+		r->head = e;
+	r->tail = e;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+
+static void* reader_thread(void *arg)
+{
+	struct tar_reader *r = (struct tar_reader*)arg;
+	uint8_t h[TAR_BLOCK_SIZE];
+	struct tar_entry *e;
+	char *longname = NULL;
+	uint64_t paxsize = 0;
+	int res = 0;
+
+	while (res == 0 && !reader_aborted(r)) {
+		uint64_t size;
+		char *buf;
+		uint8_t type;
+
+		if (read_file(r->fd, -1, h, sizeof(h))) {
+			res = -1;
+			break;
+		}
+		/* End of archive is marked with zero blocks */
+		if (is_blank_buf(h, sizeof(h), 0))
+			break;
+		if (!valid_header(h)) {
+			res = -2;
+			break;
+		}
+		type = h[156];
+		size = parse_number(h + 124, 12);
+		/* Size from pax header only applies to (next) regular file entry */
+		if (paxsize && (type == '0' || type == '7' || type == 0))
+			size = paxsize;
+
+		switch (type) {
+
+		case 'x': /* pax extended header (for next entry) */
+		case 'L': /* GNU long name (for next entry) */
+			if (!(buf = read_header_data(r->fd, size))) {
+				res = -3;
+				break;
+			}
+			if (type == 'L') {
+				free(longname);
+				longname = buf;
+			} else {
+				if (parse_pax(buf, size, &longname, &paxsize))
+					res = -4;
+				free(buf);
+			}
+			continue;
+
+		case '0':
+		case '7':
+		case 0:
+		case '5':
+			if (!(e = calloc(1, sizeof(struct tar_entry)))
+				|| !(e->name = entry_name(h, longname))) {
+				free(e);
+				res = -5;
+				break;
+			}
+			e->dir = (type == '5');
+			if (!e->dir) {
+				if (size > SSIZE_MAX) {
+					res = -6;
+				}
+				else if (!reserve_inflight(r, size)) {
+					res = -7;
+				}
+				else {
+					e->size = size;
+					if (size > 0 && !(e->data = malloc(size)))
+						res = -5;
+					else if (read_file(r->fd, -1, e->data, size)
+						|| skip_data(r->fd, padding(size)))
+						res = -1;
+				}
+			}
+			if (res == 0 && *e->name) {
+				queue_entry(r, e);
+			} else {
+				pthread_mutex_lock(&r->mutex);
+				r->inflight -= e->size;
+				pthread_mutex_unlock(&r->mutex);
+				free(e->name);
+				free(e->data);
+				free(e);
+			}
+			break;
+
+		case 'g': /* pax global header */
+			res = skip_data(r->fd, size + padding(size));
+			break;
+
+		default:
+			warn("%.100s: skip unsupported tar entry (type '%c')", h, type);
+			res = skip_data(r->fd, size + padding(size));
+			break;
+		}
+
+		/* Extended header applies only to the next entry */
+		free(longname);
+		longname = NULL;
+		paxsize = 0;
+	}
+	free(longname);
+
+	pthread_mutex_lock(&r->mutex);
+	r->done = true;
+	r->error = res;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+
+	return NULL;
+}
+
+
+static int write_entry(lfs_t *lfs, const struct tar_entry *e)
+{
+	lfs_file_t file;
+	int res;
+
+	res = lfs_file_open(lfs, &file, e->name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+	if (res != LFS_ERR_OK)
+		return res;
+	if (e->size > 0) {
+		if (lfs_file_write(lfs, &file, e->data, e->size) < (lfs_ssize_t)e->size)
+			res = LFS_ERR_IO;
+	}
+	if (lfs_file_close(lfs, &file) != LFS_ERR_OK && res == LFS_ERR_OK)
+		res = LFS_ERR_IO;
+	if (res == LFS_ERR_OK)
+		res = lfs_clear_attr(lfs, e->name, LFST_ATTR_CRC);
+
+	return res;
+}
+
+
+int lfs_tar_import(lfs_t *lfs, int fd, lfs_tar_reserve_cb reserve, bool verbose)
+{
+	struct tar_reader r;
+	struct tar_entry *e;
+	pthread_t thread;
+	char *parent = NULL;
+	char *dirname;
+	int res = 0;
+
+
+	if (!lfs || fd < 0)
+		return -1;
+
+	memset(&r, 0, sizeof(r));
+	r.fd = fd;
+	pthread_mutex_init(&r.mutex, NULL);
+	pthread_cond_init(&r.cond, NULL);
+	if (pthread_create(&thread, NULL, reader_thread, &r)) {
+		pthread_mutex_destroy(&r.mutex);
+		pthread_cond_destroy(&r.cond);
+		return -2;
+	}
+
+	/* Write entries to the filesystem in order, while reader reads ahead */
+	while (res == 0) {
+		pthread_mutex_lock(&r.mutex);
+		while (!r.head && !r.done)
+			pthread_cond_wait(&r.cond, &r.mutex);
+		if ((e = r.head)) {
+			if (!(r.head = e->next))
+				r.tail = NULL;
+		}
+		pthread_mutex_unlock(&r.mutex);
+		if (!e)
+			break;
+
+		if (verbose)
+			printf("%s\n", e->name);
+
+		/* Space is reserved before any directories are created */
+		if (e->dir) {
+			if (reserve && reserve(lfs, e->name, 0))
+				res = -3;
+			else if ((res = lfs_mkdir_parent(lfs, e->name)) != LFS_ERR_OK)
+				warn("%s: failed to create directory (%d)", e->name, res);
+		} else {
+			dirname = splitdir(e->name);
+			if (reserve && reserve(lfs, dirname, e->size)) {
+				res = -3;
+			}
+			/* Make sure parent directory exists (only once per directory) */
+			else if (dirname && *dirname && (!parent || strcmp(parent, dirname))) {
+				if ((res = lfs_mkdir_parent(lfs, dirname)) != LFS_ERR_OK)
+					warn("%s: failed to create directory (%d)", dirname, res);
+			}
+			if (dirname) {
+				free(parent);
+				parent = dirname;
+			}
+			if (res == 0 && (res = write_entry(lfs, e)) != LFS_ERR_OK)
+				warn("%s: failed to write file (%d)", e->name, res);
+		}
+
+		pthread_mutex_lock(&r.mutex);
+		r.inflight -= e->size;
+		pthread_cond_broadcast(&r.cond);
+		pthread_mutex_unlock(&r.mutex);
+		free(e->name);
+		free(e->data);
+		free(e);
+	}
+	free(parent);
+
+	pthread_mutex_lock(&r.mutex);
+	r.abort = true;
+	pthread_cond_broadcast(&r.cond);
+	pthread_mutex_unlock(&r.mutex);
+	pthread_join(thread, NULL);
+
+	while ((e = r.head)) {
+		r.head = e->next;
+		free(e->name);
+		free(e->data);
+		free(e);
+	}
+	if (res == 0 && r.error) {
+		warn("invalid or truncated tar stream (%d)", r.error);
+		res = -4;
+	}
+	pthread_mutex_destroy(&r.mutex);
+	pthread_cond_destroy(&r.cond);
+
+	return res;
+}
+
+
+static void put_octal(uint8_t *p, size_t len, uint64_t val)
+{
+	/* Zero padded, NUL terminated */
+	p[--len] = 0;
+	while (len > 0) {
+		p[--len] = '0' + (val & 7);
+		val >>= 3;
+	}
+}
+
+
+static int write_header(int fd, const char *name, uint8_t type, uint64_t size)
+{
+	uint8_t h[TAR_BLOCK_SIZE];
+	size_t len = strlen(name);
+	const char *p = NULL;
+	uint32_t sum = 0;
+
+	memset(h, 0, sizeof(h));
+
+	/* Split long names into prefix and name (at a directory separator) */
+	if (len > 100) {
+		p = name + len - 100;
+		while (*p && *p != '/')
+			p++;
+		if (!*p || !p[1] || p - name > 155)
+			return -1;
+		memcpy(h + 345, name, p - name);
+		name = p + 1;
+	}
+	memcpy(h, name, strlen(name));
+
+	put_octal(h + 100, 8, (type == '5' ? 0755 : 0644));
+	put_octal(h + 108, 8, 0);
+	put_octal(h + 116, 8, 0);
+	put_octal(h + 124, 12, size);
+	put_octal(h + 136, 12, 0);
+	h[156] = type;
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	memcpy(h + 265, "root", 4);
+	memcpy(h + 297, "root", 4);
+
+	memset(h + 148, ' ', 8);
+	for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+		sum += h[i];
+	put_octal(h + 148, 7, sum);
+
+	return (write_file(fd, -1, h, sizeof(h)) ? -2 : 0);
+}
+
+
+static int write_pax_path(int fd, const char *name)
+{
+	char *rec;
+	size_t len = strlen(name) + 7; /* " path=" and "\n" */
+	size_t n;
+	int res = 0;
+
+	/* Record length includes the length field itself */
+	n = len + snprintf(NULL, 0, "%zu", len);
+	if (snprintf(NULL, 0, "%zu", n) + len != n)
+		n++;
+
+	if (!(rec = calloc(1, n + padding(n) + 1)))
+		return -1;
+	snprintf(rec, n + 1, "%zu path=%s\n", n, name);
+	if (write_header(fd, "PaxHeader", 'x', n))
+		res = -2;
+	else if (write_file(fd, -1, rec, n + padding(n)))
+		res = -3;
+	free(rec);
+
+	return res;
+}
+
+
+static int write_entry_header(int fd, const char *name, uint8_t type, uint64_t size)
+{
+	char shortname[101];
+	int res;
+
+	/* Names that don't fit in ustar header are stored in pax header */
+	if ((res = write_header(fd, name, type, size)) != -1)
+		return res;
+	if (write_pax_path(fd, name))
+		return -3;
+	snprintf(shortname, sizeof(shortname), "%s", name);
+
+	return write_header(fd, shortname, type, size);
+}
+
+
+/* Write a file or directory from the filesystem into tar stream */
+int lfs_tar_write(lfs_t *lfs, int fd, const char *pathname, const struct lfs_info *info)
+{
+	lfs_file_t file;
+	char *name;
+	uint8_t *buf;
+	lfs_ssize_t len;
+	uint64_t written = 0;
+	int res = 0;
+
+
+	if (!lfs || fd < 0 || !pathname || !info)
+		return -1;
+
+	while (*pathname == '/' || (pathname[0] == '.' && pathname[1] == '/'))
+		pathname += (*pathname == '/' ? 1 : 2);
+
+	/* Only path components are limited by LFS_NAME_MAX, not the full path */
+	if (!(name = malloc(strlen(pathname) + 2)))
+		return -4;
+	strcpy(name, pathname);
+	if (info->type == LFS_TYPE_DIR) {
+		strcat(name, "/");
+		res = (write_entry_header(fd, name, '5', 0) ? -2 : 0);
+		free(name);
+		return res;
+	}
+
+	if (lfs_file_open(lfs, &file, pathname, LFS_O_RDONLY) != LFS_ERR_OK) {
+		free(name);
+		return -3;
+	}
+	if (!(buf = malloc(TAR_COPY_BUF_SIZE))) {
+		lfs_file_close(lfs, &file);
+		free(name);
+		return -4;
+	}
+
+	/* Size in the header must be known before the data */
+	if (write_entry_header(fd, name, '0', info->size))
+		res = -2;
+	free(name);
+
+	while (res == 0 && written < info->size) {
+		if ((len = lfs_file_read(lfs, &file, buf, TAR_COPY_BUF_SIZE)) <= 0) {
+			res = -5;
+			break;
+		}
+		if (written + len > info->size)
+			len = info->size - written;
+		if (write_file(fd, -1, buf, len))
+			res = -6;
+		written += len;
+	}
+	lfs_file_close(lfs, &file);
+
+	if (res == 0) {
+		memset(buf, 0, TAR_BLOCK_SIZE);
+		if (write_file(fd, -1, buf, padding(info->size)))
+			res = -6;
+	}
+	free(buf);
+
+	return res;
+}
+
+
+/* Write end of archive marker (two zero blocks) */
+int lfs_tar_finish(int fd)
+{
+	uint8_t buf[TAR_BLOCK_SIZE * 2];
+
+	memset(buf, 0, sizeof(buf));
+
+	return (write_file(fd, -1, buf, sizeof(buf)) ? -1 : 0);
+}
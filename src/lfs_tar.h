@@ -0,0 +1,49 @@
+/* lfs_tar.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LFS_TAR_H_
+#define _LFS_TAR_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <lfs.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* Reserve space for file data and missing directories of dirname */
+typedef int (*lfs_tar_reserve_cb)(lfs_t *lfs, const char *dirname, off_t bytes);
+
+
+int lfs_tar_import(lfs_t *lfs, int fd, lfs_tar_reserve_cb reserve, bool verbose);
+int lfs_tar_write(lfs_t *lfs, int fd, const char *pathname, const struct lfs_info *info);
+int lfs_tar_finish(int fd);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _LFS_TAR_H_ */
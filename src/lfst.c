@@ -41,13 +41,62 @@
 #include "getopt/getopt.h"
 #endif
 #include <lfs.h>
+#include <lfs_util.h>
 
 #include "lfs_driver.h"
 #include "lfs_extra.h"
+#include "lfs_tar.h"
+#include "lfs_index.h"
+#include "lfs_changeset.h"
+#include "scan.h"
+#include "container.h"
+#include "compress.h"
+#include "serve.h"
+#include "export.h"
 #include "littlefs-toy.h"
 
 #define COPY_BUF_SIZE (1024 * 1024)
 #define LFS_DEFAULT_BLOCKSIZE 4096
+#define AUTO_SIZE_MIN_BLOCKS 8
+#define AUTO_SIZE_SLACK_BLOCKS 4
+#define BLANK_MAP_CHUNK_SIZE (1024 * 1024)
+#define CONTAINER_PROBE_SIZE (1024 * 1024)
+
+enum long_only_options {
+	OPT_SYNC = 0x100,
+	OPT_CONTIGUOUS,
+	OPT_INDEX,
+	OPT_INDEX_PATTERN,
+	OPT_DELTA,
+	OPT_APPLY_DELTA,
+	OPT_CHANGESET,
+	OPT_PERSONALIZE,
+	OPT_STORE,
+	OPT_MATERIALIZE,
+	OPT_SCAN,
+	OPT_PARTITION,
+	OPT_MAX_MEMORY,
+	OPT_ERASE_VALUE,
+	OPT_BLANK_MAP,
+	OPT_UF2,
+	OPT_IHEX,
+	OPT_BASE_ADDRESS,
+	OPT_FAMILY_ID,
+	OPT_FROM_TAR,
+	OPT_TO_TAR,
+	OPT_SERVE,
+};
+
+struct lfst_partition {
+	uint64_t offset;
+	uint64_t size;
+	lfs_size_t block_size;
+};
+
+struct lfst_crc_attr {
+	uint32_t size;
+	uint32_t crc;
+};
 
 
 int command = LFS_NONE;
@@ -57,11 +106,41 @@ int direct_mode = 0;
 int shrink_mode = 0;
 int stdout_mode = 0;
 int stdin_mode = 0;
+int skip_unchanged_mode = 0;
+int finalize_mode = 0;
 char *image_file = NULL;
 char *directory = NULL;
+char *sync_dir = NULL;
+char *tar_file = NULL;
+char *to_tar_file = NULL;
+int tar_out_fd = -1;
+param_t *contiguous_list = NULL;
+char *index_file = NULL;
+char *changeset_file = NULL;
+char *personalize_file = NULL;
+char *store_dir = NULL;
+char *serve_socket = NULL;
+param_t *index_list = NULL;
 lfs_size_t block_size = LFS_DEFAULT_BLOCKSIZE;
-uint32_t image_size = 0;
-uint32_t image_offset = 0;
+uint64_t image_size = 0;
+uint64_t image_offset = 0;
+int auto_size_mode = 0;
+int auto_offset_mode = 0;
+struct lfst_partition *partitions = NULL;
+size_t partition_count = 0;
+uint64_t max_memory = 0;
+int huge_pages_mode = 0;
+int paged_mode = 0;
+int image_stream = 0;
+int compress_mode = COMPRESS_NONE;
+uint8_t erase_value = 0;
+char *blank_map_file = NULL;
+char *uf2_file = NULL;
+char *ihex_file = NULL;
+uint32_t base_address = 0;
+uint32_t family_id = UF2_FAMILY_RP2040;
+uint64_t auto_size_max = ((uint64_t)1 << 32) - LFS_DEFAULT_BLOCKSIZE;
+uint64_t auto_size_headroom = 0;
 
 static const struct option long_options[] = {
         { "create",             0, NULL,                'c' },
@@ -82,6 +161,31 @@ static const struct option long_options[] = {
         { "shrink",             0, &shrink_mode,         1 },
         { "stdout",             0, &stdout_mode,         1 },
         { "stdin",              0, &stdin_mode,          1 },
+        { "skip-unchanged",     0, &skip_unchanged_mode, 1 },
+        { "sync",               1, NULL,                OPT_SYNC },
+        { "finalize",           0, &finalize_mode,       1 },
+        { "contiguous",         1, NULL,                OPT_CONTIGUOUS },
+        { "index",              1, NULL,                OPT_INDEX },
+        { "index-pattern",      1, NULL,                OPT_INDEX_PATTERN },
+        { "delta",              0, NULL,                OPT_DELTA },
+        { "apply-delta",        0, NULL,                OPT_APPLY_DELTA },
+        { "changeset",          1, NULL,                OPT_CHANGESET },
+        { "personalize",        1, NULL,                OPT_PERSONALIZE },
+        { "store",              1, NULL,                OPT_STORE },
+        { "materialize",        1, NULL,                OPT_MATERIALIZE },
+        { "scan",               0, NULL,                OPT_SCAN },
+        { "partition",          1, NULL,                OPT_PARTITION },
+        { "max-memory",         1, NULL,                OPT_MAX_MEMORY },
+        { "huge-pages",         0, &huge_pages_mode,     1 },
+        { "erase-value",        1, NULL,                OPT_ERASE_VALUE },
+        { "blank-map",          1, NULL,                OPT_BLANK_MAP },
+        { "uf2",                1, NULL,                OPT_UF2 },
+        { "ihex",               1, NULL,                OPT_IHEX },
+        { "base-address",       1, NULL,                OPT_BASE_ADDRESS },
+        { "family-id",          1, NULL,                OPT_FAMILY_ID },
+        { "from-tar",           1, NULL,                OPT_FROM_TAR },
+        { "to-tar",             1, NULL,                OPT_TO_TAR },
+        { "serve",              1, NULL,                OPT_SERVE },
         { NULL, 0, NULL, 0 }
 };
 
@@ -96,7 +200,7 @@ int parse_params(int argc, char **argv, int start, param_t **list, bool filechec
 	int idx = start;
 	param_t *tail = NULL;
 	param_t *p;
-	char fullname[LFS_NAME_MAX * 2];
+	char *name;
 
 	*list = NULL;
 
@@ -125,11 +229,12 @@ int parse_params(int argc, char **argv, int start, param_t **list, bool filechec
 				arg++;
 		}
 
-		snprintf(fullname, sizeof(fullname), "%s%s", prefix, arg);
-
 		if (!(p = calloc(1, sizeof(param_t))))
 			fatal("out of memory");
-		p->name = strdup(fullname);
+		if (!(name = malloc(strlen(prefix) + strlen(arg) + 1)))
+			fatal("out of memory");
+		sprintf(name, "%s%s", prefix, arg);
+		p->name = name;
 
 		if (*list == NULL)
 			*list = p;
@@ -160,6 +265,51 @@ bool match_param(const char *name, param_t *list)
 }
 
 
+int file_unchanged(lfs_t *lfs, const char *pathname, lfs_size_t size)
+{
+	lfs_file_t file;
+	void *buf = NULL, *lfs_buf = NULL;
+	int fd;
+	int res = 1;
+	lfs_ssize_t len;
+
+
+	if ((fd = open_file(pathname, true)) < 0)
+		return 0;
+	if (file_size(fd) != (off_t)size) {
+		close(fd);
+		return 0;
+	}
+	if (lfs_file_open(lfs, &file, pathname, LFS_O_RDONLY) != LFS_ERR_OK) {
+		close(fd);
+		return 0;
+	}
+
+	if (!(buf = malloc(COPY_BUF_SIZE)) || !(lfs_buf = malloc(COPY_BUF_SIZE)))
+		res = -1;
+
+	/* Compare file contents one chunk at a time, stop at first mismatch */
+	while (res == 1) {
+		if ((len = lfs_file_read(lfs, &file, lfs_buf, COPY_BUF_SIZE)) <= 0) {
+			if (len < 0)
+				res = -2;
+			break;
+		}
+		if (read_file(fd, -1, buf, len) || memcmp(buf, lfs_buf, len))
+			res = 0;
+	}
+
+	lfs_file_close(lfs, &file);
+	close(fd);
+	if (buf)
+		free(buf);
+	if (lfs_buf)
+		free(lfs_buf);
+
+	return res;
+}
+
+
 int extract_file(lfs_t *lfs, const char *pathname, bool overwrite)
 {
 	lfs_file_t file;
@@ -179,8 +329,19 @@ int extract_file(lfs_t *lfs, const char *pathname, bool overwrite)
 	}
 	else {
 		/* Check if file already exists? */
-		if (!overwrite && !stat(pathname, &st))
-			return 1;
+		if (!stat(pathname, &st)) {
+			if (skip_unchanged_mode && S_ISREG(st.st_mode)) {
+				struct lfs_info info;
+
+				if (lfs_stat(lfs, pathname, &info) == LFS_ERR_OK
+					&& (off_t)info.size == st.st_size
+					&& file_unchanged(lfs, pathname, info.size) > 0)
+					return 3;
+			}
+			else if (!overwrite) {
+				return 1;
+			}
+		}
 
 		/* Create directory if needed */
 		if ((dirname = splitdir(pathname))) {
@@ -232,7 +393,7 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 	lfs_dir_t dir;
 	struct lfs_info info;
 	char separator[2] = "/";
-	char fullname[LFS_NAME_MAX * 2];
+	char *fullname;
 	size_t path_len;
 	int errors = 0;
 	int res;
@@ -241,7 +402,7 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 		return -1;
 
 	/* Check if path ends with "/" ... */
-	path_len = strnlen(path, LFS_NAME_MAX);
+	path_len = strlen(path);
 	if (path_len > 0) {
 		if (path[path_len - 1] == '/')
 			separator[0] = 0;
@@ -264,8 +425,12 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 				continue;
 		}
 
-		snprintf(fullname, sizeof(fullname), "%s%s%s", path, separator, info.name);
-		fullname[LFS_NAME_MAX] = 0;
+		/* Full path can be longer than LFS_NAME_MAX (only names are limited) */
+		if (!(fullname = malloc(path_len + strlen(info.name) + 2))) {
+			errors++;
+			break;
+		}
+		sprintf(fullname, "%s%s%s", path, separator, info.name);
 
 		if (params && !match_all) {
 			if (!match_param(fullname, params))
@@ -281,8 +446,26 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 				else
 					printf("%s\n", fullname);
 			}
+			else if (extract_mode && tar_out_fd >= 0) {
+				if ((res = lfs_tar_write(lfs, tar_out_fd, fullname, &info))) {
+					warn("%s: failed to write file to tar file (%d)", fullname, res);
+					errors++;
+					free(fullname);
+					break;
+				}
+				if (verbose_mode)
+					fprintf(stdout_mode ? stderr : stdout, "%s\n", fullname);
+			}
 			else if (extract_mode && info.type == LFS_TYPE_REG) {
-				if ((res = extract_file(lfs, fullname, overwrite_mode))) {
+				res = extract_file(lfs, fullname, overwrite_mode);
+				if (res == 3) {
+					/* Host file is identical, nothing extracted */
+					if (verbose_mode)
+						printf("%s (unchanged)\n", fullname);
+					free(fullname);
+					continue;
+				}
+				if (res) {
 					if (res > 0) {
 						if ( res == 1)
 							warn("%s: file already exists", fullname);
@@ -292,6 +475,7 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 					else
 						warn("%s: failed to extract file (%d)", fullname, res);
 					errors++;
+					free(fullname);
 					break;
 				}
 				if (verbose_mode)
@@ -302,6 +486,7 @@ int littlefs_list(lfs_t *lfs, const char *path, bool recursive, param_t *params,
 		if (info.type == LFS_TYPE_DIR && recursive) {
 			littlefs_list(lfs, fullname, recursive, params, !skip, extract_mode);
 		}
+		free(fullname);
 	}
 
 	/* Close directory */
@@ -338,6 +523,267 @@ const char* strip_path_prefix(const char *pathname)
 }
 
 
+int set_crc_attr(lfs_t *lfs, const char *pathname, lfs_size_t size, uint32_t crc)
+{
+	struct lfst_crc_attr attr;
+
+	attr.size = lfs_tole32(size);
+	attr.crc = lfs_tole32(crc);
+
+	return lfs_setattr(lfs, pathname, LFST_ATTR_CRC, &attr, sizeof(attr));
+}
+
+
+int get_crc_attr(lfs_t *lfs, const char *pathname, lfs_size_t size, uint32_t *crc)
+{
+	struct lfst_crc_attr attr;
+
+	if (lfs_getattr(lfs, pathname, LFST_ATTR_CRC, &attr, sizeof(attr)) != sizeof(attr))
+		return -1;
+	if (lfs_fromle32(attr.size) != size)
+		return -2;
+	*crc = lfs_fromle32(attr.crc);
+
+	return 0;
+}
+
+
+int host_file_crc(const char *pathname, uint32_t *crc)
+{
+	void *buf;
+	ssize_t len;
+	int fd;
+
+	if ((fd = open_file(pathname, true)) < 0)
+		return -1;
+	if (!(buf = malloc(COPY_BUF_SIZE))) {
+		close(fd);
+		return -2;
+	}
+
+	*crc = 0xffffffff;
+	while ((len = read(fd, buf, COPY_BUF_SIZE)) > 0)
+		*crc = lfs_crc(*crc, buf, len);
+
+	free(buf);
+	close(fd);
+
+	return (len < 0 ? -3 : 0);
+}
+
+
+int image_file_crc(lfs_t *lfs, const char *pathname, uint32_t *crc)
+{
+	lfs_file_t file;
+	void *buf;
+	lfs_ssize_t len;
+
+	if (lfs_file_open(lfs, &file, pathname, LFS_O_RDONLY) != LFS_ERR_OK)
+		return -1;
+	if (!(buf = malloc(COPY_BUF_SIZE))) {
+		lfs_file_close(lfs, &file);
+		return -2;
+	}
+
+	*crc = 0xffffffff;
+	while ((len = lfs_file_read(lfs, &file, buf, COPY_BUF_SIZE)) > 0)
+		*crc = lfs_crc(*crc, buf, len);
+
+	free(buf);
+	lfs_file_close(lfs, &file);
+
+	return (len < 0 ? -3 : 0);
+}
+
+
+int auto_size_grow(lfs_t *lfs, lfs_size_t blocks)
+{
+	struct lfs_context *ctx = (struct lfs_context*)lfs->cfg->context;
+	int res;
+
+	if (blocks <= lfs->block_count)
+		return 0;
+	if ((uint64_t)blocks * block_size > auto_size_max) {
+		warn("filesystem would exceed maximum size (%llu bytes)",
+			(unsigned long long)auto_size_max);
+		return -1;
+	}
+
+	if (lfs_resize_mem(ctx, (size_t)blocks * block_size))
+		return -2;
+	if ((res = lfs_fs_grow(lfs, blocks)) != LFS_ERR_OK) {
+		warn("failed to grow filesystem (%d)", res);
+		return -3;
+	}
+
+	return 0;
+}
+
+
+int auto_size_reserve(lfs_t *lfs, off_t bytes)
+{
+	lfs_ssize_t used;
+	lfs_size_t needed;
+
+	if ((used = lfs_fs_size(lfs)) < 0)
+		return -1;
+
+	/* Estimate blocks needed for file data (including CTZ pointers) */
+	needed = bytes / (block_size - 2 * sizeof(lfs_block_t)) + 1;
+	needed += AUTO_SIZE_SLACK_BLOCKS;
+
+	if (lfs->block_count - used >= needed)
+		return 0;
+
+	return auto_size_grow(lfs, used + needed);
+}
+
+
+/* Reserve space for file data and any missing directories on its path */
+int auto_size_reserve_path(lfs_t *lfs, const char *dirname, off_t bytes)
+{
+	int dirs = 0;
+
+	if (dirname && *dirname && (dirs = lfs_missing_dirs(lfs, dirname)) < 0)
+		return -1;
+
+	/* Each new directory needs a metadata pair (two blocks) */
+	return auto_size_reserve(lfs, bytes + (off_t)dirs * 2 * block_size);
+}
+
+
+int auto_size_finalize(lfs_t *lfs)
+{
+	struct lfs_context *ctx = (struct lfs_context*)lfs->cfg->context;
+	lfs_ssize_t used;
+	lfs_block_t highest;
+	lfs_size_t blocks;
+	int res;
+
+	if ((used = lfs_fs_size(lfs)) < 0)
+		return -1;
+	if (lfs_fs_highest_block(lfs, &highest) != LFS_ERR_OK)
+		return -2;
+
+	blocks = used + (auto_size_headroom + block_size - 1) / block_size;
+
+	/* Trailing free blocks can be trimmed, but blocks in use are not relocated */
+	if (blocks < highest + 1)
+		blocks = highest + 1;
+
+	if (blocks > lfs->block_count)
+		return auto_size_grow(lfs, blocks);
+
+	if (blocks < lfs->block_count) {
+		if ((res = lfs_fs_grow(lfs, blocks)) != LFS_ERR_OK) {
+			warn("failed to shrink filesystem (%d)", res);
+			return -3;
+		}
+		if (lfs_resize_mem(ctx, (size_t)blocks * block_size))
+			return -4;
+	}
+
+	return 0;
+}
+
+
+int parse_auto_size(const char *str)
+{
+	char *s, *tok, *saveptr;
+	int64_t val;
+	int res = 0;
+
+	if (!(s = strdup(str)))
+		return -1;
+
+	if (!(tok = strtok_r(s, ",", &saveptr)) || strcmp(tok, "auto"))
+		res = -2;
+
+	while (res == 0 && (tok = strtok_r(NULL, ",", &saveptr))) {
+		if (!strncmp(tok, "max=", 4)) {
+			if (parse_int_str(tok + 4, &val, 1, ((int64_t)1 << 32)))
+				res = -3;
+			else
+				auto_size_max = val;
+		}
+		else if (!strncmp(tok, "headroom=", 9)) {
+			if (parse_int_str(tok + 9, &val, 0, ((int64_t)1 << 32)))
+				res = -4;
+			else
+				auto_size_headroom = val;
+		}
+		else {
+			res = -5;
+		}
+	}
+	free(s);
+
+	return res;
+}
+
+
+bool contiguous_file(const char *pathname)
+{
+	param_t *p = contiguous_list;
+
+	while (p) {
+		if (match_pattern(p->name, pathname))
+			return true;
+		p = p->next;
+	}
+
+	return false;
+}
+
+
+int contiguous_reserve(lfs_t *lfs, off_t size)
+{
+	struct lfs_context *ctx = (struct lfs_context*)lfs->cfg->context;
+	lfs_block_t start;
+	lfs_size_t count;
+	int res;
+
+	/* Files small enough to be inlined in metadata need no blocks */
+	if (size <= (off_t)lfs->inline_max)
+		return 0;
+
+	count = lfs_ctz_blocks(lfs, size);
+	if ((res = lfs_fs_find_free_run(lfs, count, &start)) != LFS_ERR_OK)
+		return res;
+
+	return lfs_set_alloc_range(ctx, start, count);
+}
+
+
+void print_extents(lfs_t *lfs, const char *pathname)
+{
+	struct lfs_extent *extents;
+	lfs_size_t count, i;
+	bool contiguous = true;
+
+	if (lfs_file_extents(lfs, pathname, &extents, &count) != LFS_ERR_OK) {
+		warn("%s: failed to get file extents", pathname);
+		return;
+	}
+	if (count == 0) {
+		printf("%s: inlined in metadata\n", pathname);
+		return;
+	}
+
+	for (i = 1; i < count; i++) {
+		if (extents[i].block != extents[i - 1].block + 1)
+			contiguous = false;
+	}
+	printf("%s: blocks %u-%u, flash offset 0x%08llx - 0x%08llx%s\n", pathname,
+		extents[0].block, extents[count - 1].block,
+		(unsigned long long)image_offset + (uint64_t)extents[0].block * block_size,
+		(unsigned long long)image_offset
+		+ (uint64_t)(extents[count - 1].block + 1) * block_size - 1,
+		(contiguous ? "" : " (not contiguous)"));
+	free(extents);
+}
+
+
 int copy_file_in(lfs_t *lfs, const char *pathname, bool overwrite)
 {
 	lfs_file_t file;
@@ -348,6 +794,9 @@ int copy_file_in(lfs_t *lfs, const char *pathname, bool overwrite)
 	char *dirname, *p;
 	void *buf;
 	ssize_t len;
+	uint32_t crc = 0xffffffff;
+	lfs_size_t size = 0;
+	bool contiguous = false;
 
 
 	if (!lfs || !pathname)
@@ -365,45 +814,68 @@ int copy_file_in(lfs_t *lfs, const char *pathname, bool overwrite)
 	if (verbose_mode)
 		printf("%s\n", newpath);
 
-	/* Create directory for the file */
-	if (!(dirname = strdup(newpath)))
-		return -3;
-	if ((p = strrchr(dirname, '/'))) {
-		*p = 0;
-		if ((res = lfs_mkdir_parent(lfs, dirname)))
+	if (stdin_mode)
+		fd = STDIN_FILENO;
+	else if ((fd = open_file(pathname, true)) < 0)
+		return -5;
+
+	/* Create directory for the file (after making room for it) */
+	if (!(dirname = strdup(newpath))) {
+		res = -3;
+	} else {
+		if ((p = strrchr(dirname, '/')))
+			*p = 0;
+		else
+			*dirname = 0;
+		if (auto_size_mode && !stdin_mode
+			&& auto_size_reserve_path(lfs, dirname, file_size(fd)))
+			res = -9;
+		else if (*dirname && lfs_mkdir_parent(lfs, dirname) != LFS_ERR_OK)
 			res = -4;
+		free(dirname);
+	}
+	if (res) {
+		if (fd > STDERR_FILENO)
+			close(fd);
+		return res;
 	}
-	free(dirname);
 
 	/* Create the file */
-	if (stdin_mode)
-		fd = STDIN_FILENO;
-	else
-		fd = open_file(pathname, true);
-	if (fd >= 0) {
-		res = lfs_file_open(lfs, &file, newpath, LFS_O_WRONLY | LFS_O_CREAT);
-		if (res == LFS_ERR_OK) {
-			if ((buf = calloc(1, COPY_BUF_SIZE))) {
-				while ((len = read(fd, buf, COPY_BUF_SIZE)) > 0) {
-					if (lfs_file_write(lfs, &file, buf, len) < len) {
-						res = -8;
-						break;
-					}
+	res = lfs_file_open(lfs, &file, newpath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+	if (res == LFS_ERR_OK && contiguous_list && !stdin_mode) {
+		if ((contiguous = contiguous_file(newpath))) {
+			if (contiguous_reserve(lfs, file_size(fd)))
+				warn("%s: no room for contiguous allocation", newpath);
+		}
+	}
+	if (res == LFS_ERR_OK) {
+		if ((buf = calloc(1, COPY_BUF_SIZE))) {
+			while ((len = read(fd, buf, COPY_BUF_SIZE)) > 0) {
+				if (lfs_file_write(lfs, &file, buf, len) < len) {
+					res = -8;
+					break;
 				}
-				free(buf);
-			} else {
-				res = -7;
+				crc = lfs_crc(crc, buf, len);
+				size += len;
 			}
-			lfs_file_close(lfs, &file);
+			free(buf);
 		} else {
-			res =-6;
+			res = -7;
 		}
-		if (fd > STDERR_FILENO)
-			close(fd);
-	}
-	else {
-		res = -5;
+		lfs_set_alloc_range((struct lfs_context*)lfs->cfg->context, 0, 0);
+		lfs_file_close(lfs, &file);
+		/* Cached CRC would not match the new content, unless updated */
+		if (res == 0 && sync_dir)
+			set_crc_attr(lfs, newpath, size, crc);
+		else if (res == 0)
+			lfs_clear_attr(lfs, newpath, LFST_ATTR_CRC);
+		if (res == 0 && contiguous)
+			print_extents(lfs, newpath);
+	} else {
+		res =-6;
 	}
+	if (fd > STDERR_FILENO)
+		close(fd);
 
 	return res;
 }
@@ -516,103 +988,862 @@ int littlefs_add(lfs_t *lfs, param_t *params, bool overwrite)
 }
 
 
-int littlefs_del(lfs_t *lfs, param_t *params)
+int sync_file_in(lfs_t *lfs, const char *pathname, const struct stat *st)
 {
-	struct lfs_info st;
-	int res = 0;
+	struct lfs_info info;
+	const char *newpath;
+	uint32_t host_crc, img_crc;
+	int res;
 
-	if (params) {
-		param_t *p = params;
-		while (p) {
-			if (lfs_stat(lfs,p->name, &st) == LFS_ERR_OK) {
-				p->found = true;
-				if (st.type == LFS_TYPE_DIR) {
-					if ((res = lfs_rmdir_recursive(lfs, p->name))) {
-						warn("%s: failed to remove directory (%d)", p->name, res);
-						res = 1;
-						break;
-					}
-				}
-				else {
-					if ((res = lfs_remove(lfs, p->name)) != LFS_ERR_OK) {
-						warn("%s: failed to remove file (%d)", p->name, res);
-						res = 1;
-						break;
-					}
-				}
-				if (verbose_mode)
-					printf("%s\n", p->name);
 
-			}
-			p = p->next;
-		}
+	newpath = strip_path_prefix(pathname);
 
-		p = params;
-		while (p) {
-			if (!p->found) {
-				warn("%s: not found in the filesystem", p->name);
-				res = 2;
+	if (lfs_stat(lfs, newpath, &info) == LFS_ERR_OK) {
+		if (info.type == LFS_TYPE_DIR) {
+			if ((res = lfs_rmdir_recursive(lfs, newpath)))
+				return -1;
+		}
+		else if ((off_t)info.size == st->st_size) {
+			/* Same size, compare content hashes */
+			if (host_file_crc(pathname, &host_crc))
+				return -2;
+			if (get_crc_attr(lfs, newpath, info.size, &img_crc)) {
+				/* No (valid) cached hash, calculate it from the file */
+				if (image_file_crc(lfs, newpath, &img_crc))
+					return -3;
+				if (img_crc == host_crc)
+					set_crc_attr(lfs, newpath, info.size, img_crc);
+			}
+			if (img_crc == host_crc) {
+				if (verbose_mode)
+					printf("%s (unchanged)\n", newpath);
+				return 0;
 			}
-			p = p->next;
 		}
 	}
-	else {
-		warn("no files to delete from filesystem");
-		res = -42;
-	}
 
-	return res;
+	return copy_file_in(lfs, pathname, true);
 }
 
 
-int littlefs_mount(struct lfs_context *ctx, lfs_t *lfs)
+int sync_dir_in(lfs_t *lfs, const char *dirname)
 {
-	lfs_size_t new_block_size = 0;
-	int res = 0;
-	char *msg;
-
+	DIR *dir;
+	struct dirent *e;
+	struct stat st;
+	lfs_dir_t ldir;
+	struct lfs_info info;
+	char separator[2] = "/";
+	char lfs_separator[2] = "/";
+	char fullname[PATH_MAX + 1];
+	char lfsname[LFS_NAME_MAX * 2];
+	const char *newdir;
+	size_t len;
+	int res = 0;
 
-	if (!ctx || !lfs)
+
+	/* Check if path ends with "/" ... */
+	if ((len = strnlen(dirname, NAME_MAX)) > 0) {
+		if (dirname[len - 1] == '/')
+			separator[0] = 0;
+	}
+
+	newdir = strip_path_prefix(dirname);
+	if (*newdir == 0 || !strcmp(newdir, "."))
+		newdir = "/";
+	if ((len = strnlen(newdir, LFS_NAME_MAX)) > 0) {
+		if (newdir[len - 1] == '/')
+			lfs_separator[0] = 0;
+	}
+
+	/* Make sure directory exists on the filesystem */
+	if (lfs_stat(lfs, newdir, &info) == LFS_ERR_OK && info.type != LFS_TYPE_DIR) {
+		if (lfs_remove(lfs, newdir) != LFS_ERR_OK)
+			return -1;
+	}
+	if (strcmp(newdir, "/")) {
+		if (auto_size_mode && auto_size_reserve_path(lfs, newdir, 0))
+			return -1;
+		if (lfs_mkdir_parent(lfs, newdir) != LFS_ERR_OK) {
+			warn("%s: failed to create directory", newdir);
+			return -1;
+		}
+	}
+
+	/* Add new and changed entries */
+	if (!(dir = opendir(dirname))) {
+		warn("%s: failed to open directory", dirname);
+		return -2;
+	}
+	while ((e = readdir(dir))) {
+		/* Skip special directories ("." and "..") */
+		if (e->d_name[0] == '.') {
+			if (e->d_name[1] == 0)
+				continue;
+			if (e->d_name[1] == '.' && e->d_name[2] == 0)
+				continue;
+		}
+		snprintf(fullname, PATH_MAX, "%s%s%s", dirname, separator, e->d_name);
+		fullname[PATH_MAX] = 0;
+
+		if (lstat(fullname, &st)) {
+			warn("cannot stat file: %s", fullname);
+			res = -3;
+			break;
+		}
+		if (S_ISREG(st.st_mode)) {
+			if ((res = sync_file_in(lfs, fullname, &st))) {
+				warn("%s: failed to sync file (%d)", fullname, res);
+				res = -4;
+				break;
+			}
+		}
+		else if (S_ISDIR(st.st_mode)) {
+			if ((res = sync_dir_in(lfs, fullname)))
+				break;
+		}
+		else {
+			warn("%s: skip special file", fullname);
+		}
+	}
+	closedir(dir);
+	if (res)
+		return res;
+
+	/* Remove entries that no longer exist in the source directory */
+	if (lfs_dir_open(lfs, &ldir, newdir) != LFS_ERR_OK)
+		return -5;
+	while (lfs_dir_read(lfs, &ldir, &info) > 0) {
+		bool stale = true;
+
+		/* Skip special directories ("." and "..") */
+		if (info.name[0] == '.') {
+			if (info.name[1] == 0)
+				continue;
+			if (info.name[1] == '.' && info.name[2] == 0)
+				continue;
+		}
+		snprintf(fullname, PATH_MAX, "%s%s%s", dirname, separator, info.name);
+		fullname[PATH_MAX] = 0;
+		snprintf(lfsname, sizeof(lfsname), "%s%s%s", newdir, lfs_separator, info.name);
+		lfsname[LFS_NAME_MAX] = 0;
+
+		if (!lstat(fullname, &st)) {
+			if (info.type == LFS_TYPE_DIR && S_ISDIR(st.st_mode))
+				stale = false;
+			else if (info.type == LFS_TYPE_REG && S_ISREG(st.st_mode))
+				stale = false;
+		}
+		if (!stale)
+			continue;
+
+		if (info.type == LFS_TYPE_DIR)
+			res = lfs_rmdir_recursive(lfs, lfsname);
+		else
+			res = lfs_remove(lfs, lfsname);
+		if (res != LFS_ERR_OK) {
+			warn("%s: failed to remove stale entry (%d)", lfsname, res);
+			res = -6;
+			break;
+		}
+		if (verbose_mode)
+			printf("%s (deleted)\n", lfsname);
+	}
+	lfs_dir_close(lfs, &ldir);
+
+	return res;
+}
+
+
+int littlefs_sync(lfs_t *lfs, const char *dirname)
+{
+	if (!is_directory(dirname)) {
+		warn("%s: not a directory", dirname);
 		return -1;
+	}
 
-	warn_clear_last_msg();
-	warn_mode(false);
-	res = lfs_mount(lfs, &ctx->cfg);
-	warn_mode(true);
-	if (res == LFS_ERR_OK)
-		return 0;
+	return sync_dir_in(lfs, dirname);
+}
+
+
+int littlefs_del(lfs_t *lfs, param_t *params)
+{
+	struct lfs_info st;
+	int res = 0;
+
+	if (params) {
+		param_t *p = params;
+		while (p) {
+			if (lfs_stat(lfs,p->name, &st) == LFS_ERR_OK) {
+				p->found = true;
+				if (st.type == LFS_TYPE_DIR) {
+					if ((res = lfs_rmdir_recursive(lfs, p->name))) {
+						warn("%s: failed to remove directory (%d)", p->name, res);
+						res = 1;
+						break;
+					}
+				}
+				else {
+					if ((res = lfs_remove(lfs, p->name)) != LFS_ERR_OK) {
+						warn("%s: failed to remove file (%d)", p->name, res);
+						res = 1;
+						break;
+					}
+				}
+				if (verbose_mode)
+					printf("%s\n", p->name);
+
+			}
+			p = p->next;
+		}
 
-	/* I mount failed, check if blocksize was incorrect */
-	if ((msg = strdup(warn_last_msg()))) {
-		if (strstr(msg, "Invalid block size (")) {
-			char *s, *e;
-			if ((s = strrchr(msg, '('))) {
-				s++;
-				if ((e = strchr(s, ' ')))
-					*e = 0;
-				new_block_size = atoi(s);
+		p = params;
+		while (p) {
+			if (!p->found) {
+				warn("%s: not found in the filesystem", p->name);
+				res = 2;
 			}
+			p = p->next;
 		}
 	}
+	else {
+		warn("no files to delete from filesystem");
+		res = -42;
+	}
 
-	if (new_block_size >= 128) {
+	return res;
+}
+
+
+int littlefs_mount(struct lfs_context *ctx, lfs_t *lfs, size_t size)
+{
+	struct lfs_superblock_info sb;
+
+
+	if (!ctx || !lfs)
+		return -1;
+
+	/* Check filesystem blocksize from the superblock before mounting */
+	if (lfs_probe(ctx, size, &sb) == LFS_ERR_OK && sb.block_size != ctx->cfg.block_size) {
 		warn("warning: filesystem blocksize is %u (and not %u)",
-			new_block_size, block_size);
-		block_size = new_block_size;
+			sb.block_size, ctx->cfg.block_size);
+		block_size = sb.block_size;
 		lfs_change_blocksize(ctx, image_size, block_size);
-		res = lfs_mount(lfs, &ctx->cfg);
 	}
-	else {
-		if (msg && strlen(msg) > 0)
-			warn(msg);
+
+	return lfs_mount(lfs, &ctx->cfg);
+}
+
+
+int littlefs_finalize(struct lfs_context *ctx, lfs_t *lfs)
+{
+	int res;
+
+
+	/* Resolve any orphans and pending moves, so that mount does not
+	 * need to fix them up.
+	 * Note, metadata logs are not compacted here: with prog_size equal
+	 * to block_size every commit fills a whole block, so there is never
+	 * a partially used log for lfs_fs_gc() to compact. */
+	if ((res = lfs_fs_mkconsistent(lfs)) != LFS_ERR_OK) {
+		warn("failed to make filesystem consistent (%d)", res);
+		return -1;
+	}
+
+	/* Remount to measure how much metadata must be read when mounting */
+	if ((res = lfs_unmount(lfs)) != LFS_ERR_OK)
+		return -2;
+	lfs_reset_stats(ctx);
+	if ((res = lfs_mount(lfs, &ctx->cfg)) != LFS_ERR_OK) {
+		warn("failed to remount filesystem (%d)", res);
+		return -3;
+	}
+	if (!stdout_mode)
+		printf("Metadata read at mount: %llu bytes (%u blocksize)\n",
+			(unsigned long long)ctx->read_bytes, block_size);
+
+	return 0;
+}
+
+
+int index_filter(const char *pathname, void *arg)
+{
+	param_t *p = (param_t*)arg;
+
+	if (!p)
+		return 1;
+
+	while (p) {
+		if (match_pattern(p->name, pathname))
+			return 1;
+		p = p->next;
+	}
+
+	return 0;
+}
+
+
+int littlefs_write_index(lfs_t *lfs, const char *filename)
+{
+	int fd, res;
+
+	if ((fd = create_file(filename, 0)) < 0)
+		return -1;
+
+	res = lfs_write_extent_index(lfs, fd, image_offset, index_filter, index_list);
+	close(fd);
+
+	return res;
+}
+
+
+int littlefs_changeset(lfs_t *lfs, const char *newpath, const char *filename)
+{
+	struct lfs_tree old_tree = { lfs, NULL };
+	struct lfs_tree new_tree = { NULL, newpath };
+	struct lfs_context *ctx = NULL;
+	lfs_t new_lfs;
+	void *buf = NULL;
+	off_t size;
+	int fd, res;
+
+
+	/* New tree is either a directory or another image file */
+	if (!is_directory(newpath)) {
+		if ((fd = open_file(newpath, true)) < 0) {
+			warn("%s: cannot open image file", newpath);
+			return -1;
+		}
+		size = file_size(fd) - image_offset;
+		if (size < (off_t)block_size || !(buf = malloc(size))
+			|| read_file(fd, image_offset, buf, size)) {
+			warn("%s: failed to read image from file", newpath);
+			close(fd);
+			free(buf);
+			return -2;
+		}
+		close(fd);
+		if (!(ctx = lfs_init_mem(buf, 0, block_size))) {
+			free(buf);
+			return -3;
+		}
+		if ((res = littlefs_mount(ctx, &new_lfs, size))) {
+			warn("%s: failed to mount LittleFS (%d)", newpath, res);
+			lfs_destroy_context(ctx);
+			free(buf);
+			return -4;
+		}
+		new_tree.lfs = &new_lfs;
+	}
+
+	if ((fd = create_file(filename, 0)) < 0) {
+		res = -5;
+	} else {
+		if ((res = lfs_write_changeset(&old_tree, &new_tree, fd, verbose_mode)))
+			warn("%s: failed to write changeset (%d)", filename, res);
+		close(fd);
+	}
+
+	if (ctx) {
+		lfs_unmount(&new_lfs);
+		lfs_destroy_context(ctx);
+		free(buf);
+	}
+
+	return res;
+}
+
+
+int add_partition(uint64_t offset, uint64_t size, lfs_size_t bs)
+{
+	struct lfst_partition *p;
+
+	if (!(p = realloc(partitions, (partition_count + 1) * sizeof(struct lfst_partition))))
+		return -1;
+	partitions = p;
+	p = &partitions[partition_count++];
+	p->offset = offset;
+	p->size = size;
+	p->block_size = bs;
+
+	return 0;
+}
+
+
+int add_partition_str(const char *str)
+{
+	char *s, *size_str;
+	int64_t offset, size = 0;
+	int res = 0;
+
+	if (!(s = strdup(str)))
+		return -1;
+	if ((size_str = strchr(s, ':')))
+		*size_str++ = 0;
+
+	if (parse_int_str(s, &offset, 0, INT64_MAX))
+		res = -2;
+	else if (size_str && parse_int_str(size_str, &size, 0, INT64_MAX))
+		res = -3;
+	else
+		res = add_partition(offset, size, 0);
+	free(s);
+
+	return res;
+}
+
+
+static int compare_partitions(const void *a, const void *b)
+{
+	const struct lfst_partition *pa = a;
+	const struct lfst_partition *pb = b;
+
+	return (pa->offset < pb->offset ? -1 : (pa->offset > pb->offset ? 1 : 0));
+}
+
+
+int check_partitions()
+{
+	qsort(partitions, partition_count, sizeof(struct lfst_partition), compare_partitions);
+
+	for (size_t i = 0; i + 1 < partition_count; i++) {
+		struct lfst_partition *p = &partitions[i];
+
+		if (p->offset == partitions[i + 1].offset)
+			return -1;
+		if (p->size > 0 && p->offset + p->size > partitions[i + 1].offset)
+			return -2;
+	}
+
+	return 0;
+}
+
+
+int littlefs_partition(lfs_t *lfs, param_t *params, const char *subdir)
+{
+	int res = 0;
+
+	switch (command) {
+
+	case LFS_EXTRACT:
+	case LFS_LIST:
+		/* Extract each partition into its own directory */
+		if (command == LFS_EXTRACT) {
+			if (mkdir_parent(subdir, 0755) || chdir(subdir)) {
+				warn("%s: cannot create directory", subdir);
+				return -1;
+			}
+		}
+		if (littlefs_list(lfs, "./", true, params, false,
+					command == LFS_EXTRACT ? true : false) > 0)
+			res = 1;
+		if (command == LFS_EXTRACT) {
+			if (chdir(".."))
+				fatal("cannot change directory to: ..");
+		}
+		break;
+
+	case LFS_UPDATE:
+		if (sync_dir)
+			res = littlefs_sync(lfs, sync_dir);
+		else
+			res = littlefs_add(lfs, params, true);
+		break;
+
+	case LFS_DELETE:
+		res = littlefs_del(lfs, params);
+		break;
+
+	default:
+		fatal("internal error");
+
+	}
+
+	return res;
+}
+
+
+int littlefs_partitions(int fd, param_t *params)
+{
+	struct lfs_context *ctx;
+	lfs_size_t default_block_size = block_size;
+	lfs_t lfs;
+	uint8_t *buf;
+	uint64_t start = UINT64_MAX, end = 0;
+	off_t fsize;
+	char subdir[32];
+	int ret = 0;
+	int res;
+
+
+	if ((fsize = file_size(fd)) < 0)
+		fatal("%s: cannot get file image file size", image_file);
+
+	/* Read all partitions into one shared buffer */
+	for (size_t i = 0; i < partition_count; i++) {
+		struct lfst_partition *p = &partitions[i];
+		uint64_t p_end = (p->size > 0 ? (uint64_t)p->offset + p->size : (uint64_t)fsize);
+
+		if (p_end > (uint64_t)fsize || p->offset >= p_end)
+			fatal("%s: partition at 0x%08llx does not fit in the file", image_file,
+				(unsigned long long)p->offset);
+		if (p->offset < start)
+			start = p->offset;
+		if (p_end > end)
+			end = p_end;
 	}
-	if (msg)
-		free(msg);
+	if (!(buf = malloc(end - start)))
+		fatal("out of memory");
+	if ((res = read_file(fd, start, buf, end - start)))
+		fatal("%s: failed to read image from file (%d)", image_file, errno);
+
+	for (size_t i = 0; i < partition_count; i++) {
+		struct lfst_partition *p = &partitions[i];
+		uint64_t p_size = (p->size > 0 ? p->size : (uint64_t)fsize - p->offset);
+
+		image_offset = p->offset;
+		image_size = p->size;
+		/* Blocksize detected (by littlefs_mount) for previous partition
+		   does not apply to this one */
+		block_size = (p->block_size > 0 ? p->block_size : default_block_size);
+		if (!(ctx = lfs_init_mem(buf + (p->offset - start), image_size, block_size)))
+			fatal("failed to initialize LittleFS");
+		lfs_set_erase_value(ctx, erase_value);
+		if ((res = littlefs_mount(ctx, &lfs, p_size))) {
+			warn("%s: failed to mount LittleFS at 0x%08llx (%d)", image_file,
+				(unsigned long long)p->offset, res);
+			lfs_destroy_context(ctx);
+			ret = 1;
+			continue;
+		}
+		if (p->size == 0)
+			ctx->cfg.block_count = lfs.block_count;
+		image_size = (uint64_t)block_size * lfs.block_count;
+		if (i + 1 < partition_count
+			&& p->offset + image_size > partitions[i + 1].offset) {
+			warn("%s: partition at 0x%08llx overlaps with partition at 0x%08llx",
+				image_file, (unsigned long long)p->offset,
+				(unsigned long long)partitions[i + 1].offset);
+			lfs_unmount(&lfs);
+			lfs_destroy_context(ctx);
+			ret = 1;
+			continue;
+		}
+
+		if (command == LFS_LIST || verbose_mode)
+			printf("%sPartition 0x%08llx:\n", (i > 0 ? "\n" : ""),
+				(unsigned long long)p->offset);
+
+		snprintf(subdir, sizeof(subdir), "0x%08llx", (unsigned long long)p->offset);
+		if (littlefs_partition(&lfs, params, subdir))
+			ret = 1;
+
+		if (finalize_mode) {
+			if ((res = littlefs_finalize(ctx, &lfs)))
+				fatal("%s: failed to finalize LittleFS (%d)", image_file, res);
+		}
+		if ((res = lfs_unmount(&lfs)) != LFS_ERR_OK)
+			fatal("%s: failed to unmount LittleFS (%d)", image_file, res);
+
+		/* Write back only partitions that were modified */
+		if (ctx->prog_bytes > 0 || ctx->erase_count > 0) {
+			if ((res = write_file_sparse(fd, p->offset, ctx->base, image_size,
+								block_size)))
+				fatal("%s: failed to write image to file (%d)", image_file, errno);
+		}
+		lfs_destroy_context(ctx);
+	}
+	free(buf);
+
+	if (command == LFS_LIST || command == LFS_EXTRACT) {
+		param_t *param = params;
+		while (param) {
+			if (!param->found) {
+				warn("%s: not found in the filesystem", param->name);
+				ret = 2;
+			}
+			param = param->next;
+		}
+	}
+
+	return ret;
+}
+
+
+int littlefs_blank_map(int fd, const char *filename)
+{
+	FILE *fp;
+	uint8_t *buf;
+	size_t chunk = (BLANK_MAP_CHUNK_SIZE / block_size + 1) * block_size;
+	uint64_t pos = 0, start = 0, blank = 0;
+	bool in_blank = false;
+	int res = 0;
+
+
+	if (!(buf = malloc(chunk)))
+		return -1;
+	if (!(fp = fopen(filename, "w"))) {
+		warn("%s: cannot create file", filename);
+		free(buf);
+		return -2;
+	}
+
+	fprintf(fp, "# Blank (erase value 0x%02x) regions in %s\n", erase_value, image_file);
+	fprintf(fp, "# offset     size\n");
+
+	/* Scan image one block at a time, and output runs of blank blocks */
+	while (pos < image_size && res == 0) {
+		size_t len = (image_size - pos > chunk ? chunk : image_size - pos);
+
+		if (read_file(fd, image_offset + pos, buf, len)) {
+			res = -3;
+			break;
+		}
+		for (size_t i = 0; i < len; i += block_size) {
+			size_t n = (len - i > block_size ? block_size : len - i);
+			bool is_blank = is_blank_buf(buf + i, n, erase_value);
+
+			if (is_blank && !in_blank) {
+				start = pos + i;
+				in_blank = true;
+			}
+			else if (!is_blank && in_blank) {
+				fprintf(fp, "0x%08llx 0x%08llx\n",
+					(unsigned long long)(image_offset + start),
+					(unsigned long long)(pos + i - start));
+				blank += pos + i - start;
+				in_blank = false;
+			}
+		}
+		pos += len;
+	}
+	if (in_blank && res == 0) {
+		fprintf(fp, "0x%08llx 0x%08llx\n", (unsigned long long)(image_offset + start),
+			(unsigned long long)(image_size - start));
+		blank += image_size - start;
+	}
+	if (fclose(fp) && res == 0)
+		res = -4;
+	free(buf);
+
+	if (res == 0 && verbose_mode && !stdout_mode)
+		printf("Blank regions: %llu bytes of %llu (%llu%%)\n",
+			(unsigned long long)blank, (unsigned long long)image_size,
+			(unsigned long long)(image_size > 0 ? blank * 100 / image_size : 0));
+
+	return res;
+}
+
+
+/* Read (possibly compressed) image from a stream (into memory) */
+int littlefs_read_stream(int fd, void **buf)
+{
+	struct lfs_superblock_info sb;
+	size_t len;
+	void *p;
+	int type;
+
+
+	if (read_stream(fd, buf, &len))
+		return -1;
+
+	if ((type = compress_detect(*buf, len)) > COMPRESS_NONE) {
+		if (!compress_supported(type))
+			return -5;
+		if (decompress_buf(type, *buf, len, &p, &len)) {
+			free(*buf);
+			*buf = NULL;
+			return -6;
+		}
+		free(*buf);
+		*buf = p;
+		/* Image is written back using same compression */
+		compress_mode = type;
+	}
+
+	if (image_size == 0) {
+		/* Get filesystem size from the superblock */
+		if (lfs_parse_superblock(*buf, len, &sb))
+			return -2;
+		block_size = sb.block_size;
+		image_size = (uint64_t)sb.block_size * sb.block_count;
+	}
+	if (image_size > SSIZE_MAX)
+		return -3;
+	if (len < image_size) {
+		/* Blank blocks at the end of the filesystem may have been left out */
+		if (!(p = realloc(*buf, image_size)))
+			return -4;
+		memset(p + len, erase_value, image_size - len);
+		*buf = p;
+	}
+
+	return 0;
+}
+
+
+/* Write modified image back to the firmware container (as a new file) */
+int littlefs_container_write(const char *filename, const struct container *cont,
+		const void *buf, lfs_size_t count, const uint32_t *used)
+{
+	struct export_image img = {
+		.fd = -1,
+		.buf = buf,
+		.block_size = block_size,
+		.block_count = count,
+		.used = used,
+		.erase_value = erase_value,
+		.base_address = image_offset,
+		.family_id = (cont->family_id ? cont->family_id : family_id),
+		.keep = cont,
+	};
+	char tmpfile[PATH_MAX + 1];
+	int res;
+
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+	if (cont->type == CONTAINER_UF2)
+		res = export_uf2(tmpfile, &img, false);
+	else
+		res = export_ihex(tmpfile, &img, false);
+	if (res == 0 && rename(tmpfile, filename))
+		res = -20;
+	if (res)
+		unlink(tmpfile);
+
+	return res;
+}
+
+
+/* Write modified image back to the compressed image file (as a new file) */
+int littlefs_compress_write(const char *filename, const void *buf)
+{
+	char tmpfile[PATH_MAX + 1];
+	int fd, res;
+
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+	if ((fd = create_file(tmpfile, 0)) < 0)
+		return -1;
+	res = compress_write(fd, compress_mode, buf, image_size);
+	if (close(fd) && res == 0)
+		res = -20;
+	if (res == 0 && rename(tmpfile, filename))
+		res = -21;
+	if (res)
+		unlink(tmpfile);
 
 	return res;
 }
 
 
+/* Keep image(s) mounted, and serve requests until shutdown */
+int littlefs_serve(int argc, char **argv)
+{
+	size_t count = 1 + (argc - optind);
+	char **images;
+	int res;
+
+
+	if (!(images = calloc(count, sizeof(char*))))
+		fatal("out of memory");
+	images[0] = image_file;
+	for (int i = optind; i < argc; i++)
+		images[1 + i - optind] = argv[i];
+	for (size_t i = 0; i < count; i++) {
+		if (!file_exists(images[i]))
+			fatal("image file not found: %s", images[i]);
+	}
+
+	if ((res = serve_images(serve_socket, images, count, erase_value, verbose_mode)))
+		fatal("%s: failed to serve images (%d)", serve_socket, res);
+	free(images);
+
+	return 0;
+}
+
+
+int littlefs_scan(const char *filename)
+{
+	struct scan_result *results;
+	struct stat st;
+	size_t count;
+	int res;
+
+	if (stat(filename, &st))
+		fatal("%s: cannot stat file", filename);
+	if ((res = scan_image(filename, &results, &count)))
+		fatal("%s: failed to scan image file (%d)", filename, res);
+
+	for (size_t i = 0; i < count; i++) {
+		struct scan_result *r = &results[i];
+		uint64_t size = (uint64_t)r->block_size * r->block_count;
+
+		printf("0x%08llx: LittleFS v%u.%u, block size %u, block count %u (%llu bytes)%s\n",
+			(unsigned long long)r->offset, r->version >> 16, r->version & 0xffff,
+			r->block_size, r->block_count, (unsigned long long)size,
+			((uint64_t)r->offset + size > (uint64_t)st.st_size ? " (truncated)" : ""));
+	}
+	free(results);
+
+	if (count < 1) {
+		warn("%s: no LittleFS filesystems found", filename);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int find_offset(const char *filename)
+{
+	struct scan_result *results;
+	size_t count;
+	int res;
+
+	if ((res = scan_image(filename, &results, &count)))
+		return res;
+	if (count < 1)
+		return -1;
+
+	/* Use all filesystems found, when command supports multiple partitions */
+	if (count > 1 && (command == LFS_LIST || command == LFS_EXTRACT
+				|| command == LFS_UPDATE || command == LFS_DELETE)
+		&& !direct_mode && !index_file) {
+		for (size_t i = 0; i < count && res == 0; i++) {
+			res = add_partition(results[i].offset,
+					(uint64_t)results[i].block_size * results[i].block_count,
+					results[i].block_size);
+		}
+		free(results);
+		return res;
+	}
+	if (count > 1 && verbose_mode)
+		warn("%s: %zu filesystems found, using first one", filename, count);
+	image_offset = results[0].offset;
+	block_size = results[0].block_size;
+	if (verbose_mode > 1)
+		printf("Filesystem offset: 0x%08llx\n", (unsigned long long)image_offset);
+	free(results);
+
+	return 0;
+}
+
+
+const char* store_name(int argc, char **argv)
+{
+	const char *name;
+
+	/* Use image file name, if name not given */
+	if (argc - optind > 0)
+		return argv[optind];
+	if ((name = strrchr(image_file, '/')))
+		return name + 1;
+
+	return image_file;
+}
+
+
 void print_version()
 {
 #ifdef  __DATE__
@@ -645,16 +1876,44 @@ void print_usage()
 		"  -r, --append               Append (add) files to existing LFS image\n"
 		"  -d, --delete               Remove files from existing LFS image\n"
 		"  -t, --list                 List contents of existing LFS image\n"
-		"  -x, --extract              Extract files from existing LFS image\n\n"
+		"  -x, --extract              Extract files from existing LFS image\n"
+		"  --delta                    Create block level delta between two images\n"
+		"                             (lfst --delta -f patch OLD.img NEW.img)\n"
+		"  --apply-delta              Apply delta patch to an image\n"
+		"                             (lfst --apply-delta -f image patch)\n"
+		"  --changeset=<file>         Create file level changeset between two images\n"
+		"                             (lfst --changeset=file -f OLD.img NEW.img|DIR)\n"
+		"  --store=<dir>              Store image into content-addressed block store\n"
+		"                             (lfst --store=dir -f image [name])\n"
+		"  --materialize=<dir>        Reconstruct image from block store\n"
+		"                             (lfst --materialize=dir -f image [name])\n"
+		"  --scan                     Scan file for LittleFS filesystems\n"
+		"  --serve=<socket>           Keep image(s) mounted and serve requests over\n"
+		"                             Unix domain socket\n"
+		"                             (lfst --serve=socket -f image [image...])\n\n"
 		" Options:\n"
 		" -f <imagefile>, --file=<imagefile>\n"
                 "                             Specify LFS image file location\n"
+		"                             (- = read image from stdin / write to stdout)\n"
 		" -b <blocksize>, --block-size=<blocksize>\n"
 		"                             LFS filesystem blocksize (default: %d)\n"
 		" -s <imagesize>, --size=<imagesize>\n"
 		"                             LFS filesystem size (required with -c)\n"
+		" -s auto[,max=<size>][,headroom=<size>]\n"
+		"                             Use smallest filesystem size that fits the files\n"
 		" -o <imageoffset>, --offset=<imageoffset>\n"
                 "                             LFS filesystem start offset (default: 0)\n"
+		" -o auto, --offset=auto      Find filesystem offset by scanning the image file\n"
+		" --partition=<offset>[:<size>]\n"
+		"                             Process filesystem at offset (can be repeated)\n"
+		" --max-memory=<size>         Load image on demand using at most size of memory\n"
+		" --huge-pages                Use huge pages for the --max-memory block cache\n"
+		" --erase-value=<value>       Value of erased flash bytes (default: 0x00)\n"
+		" --blank-map=<file>          Write list of blank (erased) regions to a file\n"
+		" --uf2=<file>                Export filesystem (used blocks only) as UF2 file\n"
+		" --ihex=<file>               Export filesystem (used blocks only) as Intel HEX\n"
+		" --base-address=<addr>       Flash address of the filesystem (default: 0)\n"
+		" --family-id=<id>            UF2 family ID (default: 0xe48bff56 = RP2040)\n"
 		" -h, --help                  Display usage information and exit\n"
 		" -v, --verbose               Enable verbose mode\n"
 		" -V, --version               Display program version\n"
@@ -663,6 +1922,15 @@ void print_usage()
 		" --shrink                    Truncate image file at the end of LFS image\n"
 		" --stdout                    When extracting file(s) extract to stdout\n"
 		" --stdin                     When adding file read file from stdin\n"
+		" --skip-unchanged            When extracting, only overwrite files that differ\n"
+		" --sync=<dir>                Mirror directory into image (only write changes)\n"
+		" --finalize                  Resolve pending operations and report mount cost\n"
+		" --from-tar=<file>           Add files from a tar file (- = stdin)\n"
+		" --to-tar=<file>             When extracting, write files as tar file (- = stdout)\n"
+		" --contiguous=<pattern>      Store matching files in contiguous blocks\n"
+		" --index=<file>              Write file extent (block) index to a file\n"
+		" --index-pattern=<pattern>   Only include matching files in the index\n"
+		" --personalize=<manifest>    Create personalized copies of the image\n"
 		"\n\n", LFS_DEFAULT_BLOCKSIZE);
 }
 
@@ -700,6 +1968,21 @@ int parse_arguments(int argc, char **argv)
 			command = LFS_EXTRACT;
 			break;
 
+		case OPT_DELTA:
+			command = LFS_DELTA;
+			break;
+
+		case OPT_APPLY_DELTA:
+			command = LFS_APPLY_DELTA;
+			break;
+
+		case OPT_CHANGESET:
+			command = LFS_CHANGESET;
+			if (changeset_file)
+				free(changeset_file);
+			changeset_file = strdup(optarg);
+			break;
+
 		case 'f':
 			image_file = strdup(optarg);
 			break;
@@ -712,14 +1995,24 @@ int parse_arguments(int argc, char **argv)
 			break;
 
 		case 's':
-			if (parse_int_str(optarg, &val, 0, ((int64_t)1 << 32))) {
+			if (!strncmp(optarg, "auto", 4)) {
+				if (parse_auto_size(optarg))
+					fatal("invalid filesystem size specified: %s", optarg);
+				auto_size_mode = 1;
+				break;
+			}
+			if (parse_int_str(optarg, &val, 0, INT64_MAX)) {
 				fatal("invalid filesystem size specified: %s", optarg);
 			}
 			image_size = val;
 			break;
 
 		case 'o':
-			if (parse_int_str(optarg, &val, 0, ((int64_t)1 << 32))) {
+			if (!strcmp(optarg, "auto")) {
+				auto_offset_mode = 1;
+				break;
+			}
+			if (parse_int_str(optarg, &val, 0, INT64_MAX)) {
 				fatal("invalid filesystem offset specified: %s", optarg);
 				exit(1);
 			}
@@ -748,6 +2041,119 @@ int parse_arguments(int argc, char **argv)
 			overwrite_mode = 1;
 			break;
 
+		case OPT_CONTIGUOUS:
+		case OPT_INDEX_PATTERN:
+			{
+				param_t *p;
+
+				if (!(p = calloc(1, sizeof(param_t))))
+					fatal("out of memory");
+				p->name = strdup(optarg);
+				if (c == OPT_CONTIGUOUS) {
+					p->next = contiguous_list;
+					contiguous_list = p;
+				} else {
+					p->next = index_list;
+					index_list = p;
+				}
+			}
+			break;
+
+		case OPT_INDEX:
+			if (index_file)
+				free(index_file);
+			index_file = strdup(optarg);
+			break;
+
+		case OPT_SCAN:
+			command = LFS_SCAN;
+			break;
+
+		case OPT_SERVE:
+			command = LFS_SERVE;
+			if (serve_socket)
+				free(serve_socket);
+			serve_socket = strdup(optarg);
+			break;
+
+		case OPT_PARTITION:
+			if (add_partition_str(optarg))
+				fatal("invalid partition specified: %s", optarg);
+			break;
+
+		case OPT_MAX_MEMORY:
+			if (parse_int_str(optarg, &val, 1, SSIZE_MAX))
+				fatal("invalid memory limit specified: %s", optarg);
+			max_memory = val;
+			break;
+
+		case OPT_ERASE_VALUE:
+			if (parse_int_str(optarg, &val, 0, 255))
+				fatal("invalid erase value specified: %s", optarg);
+			erase_value = val;
+			break;
+
+		case OPT_BLANK_MAP:
+			if (blank_map_file)
+				free(blank_map_file);
+			blank_map_file = strdup(optarg);
+			break;
+
+		case OPT_UF2:
+			if (uf2_file)
+				free(uf2_file);
+			uf2_file = strdup(optarg);
+			break;
+
+		case OPT_IHEX:
+			if (ihex_file)
+				free(ihex_file);
+			ihex_file = strdup(optarg);
+			break;
+
+		case OPT_BASE_ADDRESS:
+		case OPT_FAMILY_ID:
+			if (parse_int_str(optarg, &val, 0, UINT32_MAX))
+				fatal("invalid %s specified: %s",
+					(c == OPT_BASE_ADDRESS ? "base address" : "family ID"), optarg);
+			if (c == OPT_BASE_ADDRESS)
+				base_address = val;
+			else
+				family_id = val;
+			break;
+
+		case OPT_STORE:
+		case OPT_MATERIALIZE:
+			command = (c == OPT_STORE ? LFS_STORE : LFS_MATERIALIZE);
+			if (store_dir)
+				free(store_dir);
+			store_dir = strdup(optarg);
+			break;
+
+		case OPT_PERSONALIZE:
+			if (personalize_file)
+				free(personalize_file);
+			personalize_file = strdup(optarg);
+			break;
+
+		case OPT_SYNC:
+			if (sync_dir)
+				free(sync_dir);
+			sync_dir = strdup(optarg);
+			break;
+
+		case OPT_FROM_TAR:
+			if (tar_file)
+				free(tar_file);
+			tar_file = strdup(optarg);
+			break;
+
+		case OPT_TO_TAR:
+			if (to_tar_file)
+				free(to_tar_file);
+			to_tar_file = strdup(optarg);
+			break;
+
 		case '?':
 			fprintf(stderr, "Try '%s --help' for more information.\n", PROGRAMNAME);
 			exit(1);
@@ -764,10 +2170,156 @@ int parse_arguments(int argc, char **argv)
 	if (!image_file)
 		fatal("no image file (-f <filename>) specified");
 
+	if (!strcmp(image_file, "-")) {
+		if (command == LFS_DELTA || command == LFS_APPLY_DELTA || command == LFS_SCAN
+			|| command == LFS_MATERIALIZE || command == LFS_SERVE)
+			fatal("-f - cannot be used with --delta, --apply-delta, --scan, "
+				"--materialize, or --serve");
+		if (direct_mode || max_memory > 0 || partition_count > 0 || auto_offset_mode
+			|| image_offset > 0 || blank_map_file || shrink_mode)
+			fatal("-f - cannot be combined with --direct, --max-memory, --partition, "
+				"-o, --blank-map, or --shrink");
+		if (stdin_mode && command != LFS_CREATE)
+			fatal("--stdin cannot be used when reading image from stdin");
+		if (stdout_mode && command != LFS_LIST && command != LFS_EXTRACT)
+			fatal("--stdout cannot be used when writing image to stdout");
+		image_stream = 1;
+	}
+
+	/* Compressed image file is detected from the contents (or from the file name
+	   when creating a new image) */
+	if (!image_stream && command != LFS_DELTA && command != LFS_APPLY_DELTA
+		&& command != LFS_SCAN && command != LFS_MATERIALIZE && command != LFS_SERVE) {
+		if (command == LFS_CREATE)
+			compress_mode = compress_detect_name(image_file);
+		else if (file_exists(image_file))
+			compress_mode = compress_detect_file(image_file);
+	}
+	if (compress_mode) {
+		if (!compress_supported(compress_mode))
+			fatal("%s: %s compressed images not supported in this build", image_file,
+				compress_name(compress_mode));
+		if (direct_mode || max_memory > 0 || partition_count > 0 || auto_offset_mode
+			|| image_offset > 0 || blank_map_file || shrink_mode)
+			fatal("compressed images cannot be used with --direct, --max-memory, "
+				"--partition, -o, --blank-map, or --shrink");
+	}
+
+	if (sync_dir && command != LFS_CREATE && command != LFS_UPDATE)
+		fatal("--sync can only be used when creating or updating an image");
+
+	if (tar_file) {
+		if (command != LFS_CREATE && command != LFS_UPDATE)
+			fatal("--from-tar can only be used when creating or updating an image");
+		if (sync_dir || stdin_mode || contiguous_list)
+			fatal("--from-tar cannot be combined with --sync, --stdin, or --contiguous");
+		if (argc - optind > 0)
+			fatal("files cannot be specified with --from-tar");
+		if (!strcmp(tar_file, "-") && image_stream && command != LFS_CREATE)
+			fatal("--from-tar=- cannot be used when reading image from stdin");
+	}
+
+	if (to_tar_file) {
+		if (command != LFS_EXTRACT)
+			fatal("--to-tar can only be used when extracting files");
+		if (partition_count > 0 || skip_unchanged_mode)
+			fatal("--to-tar cannot be combined with --partition or --skip-unchanged");
+		if (stdout_mode && strcmp(to_tar_file, "-"))
+			fatal("--stdout cannot be used with --to-tar=<file>");
+		/* Tar stream goes to stdout, so other output goes to stderr */
+		if (!strcmp(to_tar_file, "-"))
+			stdout_mode = 1;
+	}
+
+	if (finalize_mode && (command == LFS_LIST || command == LFS_EXTRACT
+				|| command == LFS_CHANGESET || command == LFS_STORE))
+		fatal("--finalize can only be used when modifying an image");
+
+	if (auto_offset_mode && command == LFS_CREATE)
+		fatal("automatic offset cannot be used when creating an image");
+
+	if (partition_count > 0) {
+		if (command != LFS_LIST && command != LFS_EXTRACT && command != LFS_UPDATE
+			&& command != LFS_DELETE)
+			fatal("--partition can only be used when listing, extracting, updating, "
+				"or deleting files");
+		if (direct_mode || stdin_mode || index_file || auto_offset_mode)
+			fatal("--partition cannot be combined with --direct, --stdin, --index, "
+				"or -o auto");
+		if (check_partitions())
+			fatal("overlapping partitions specified");
+		if (blank_map_file || uf2_file || ihex_file)
+			fatal("--partition cannot be combined with --blank-map, --uf2, or --ihex");
+	}
+
+	if (personalize_file) {
+		if (command != LFS_CREATE && command != LFS_UPDATE)
+			fatal("--personalize can only be used when creating or updating an image");
+		if (direct_mode)
+			fatal("--personalize cannot be used with --direct");
+	}
+
+	if (command == LFS_STORE || command == LFS_MATERIALIZE) {
+		if (argc - optind > 1)
+			fatal("only one image name can be specified");
+		if (command == LFS_STORE && direct_mode)
+			fatal("--store cannot be used with --direct");
+	}
+
+	if (command == LFS_SERVE) {
+		if (direct_mode || max_memory > 0 || partition_count > 0 || auto_offset_mode
+			|| image_offset > 0 || blank_map_file || shrink_mode)
+			fatal("--serve cannot be combined with --direct, --max-memory, "
+				"--partition, -o, --blank-map, or --shrink");
+	}
+
+	if (command == LFS_CHANGESET) {
+		if (argc - optind != 1)
+			fatal("new image file or directory must be specified");
+		if (!overwrite_mode && file_exists(changeset_file))
+			fatal("changeset file already exists: %s", changeset_file);
+	}
+
+	if (auto_size_mode) {
+		if (command != LFS_CREATE)
+			fatal("automatic image size can only be used when creating an image");
+		if (direct_mode)
+			fatal("automatic image size cannot be used with --direct");
+		if (stdin_mode)
+			fatal("automatic image size cannot be used with --stdin");
+		if (auto_size_max < (uint64_t)block_size * AUTO_SIZE_MIN_BLOCKS)
+			fatal("maximum image size too small: %llu",
+				(unsigned long long)auto_size_max);
+		image_size = block_size * AUTO_SIZE_MIN_BLOCKS;
+	}
+
 	if (command == LFS_CREATE) {
 		if (image_size < 1)
 			fatal("image size (-s <imagesize>) must be set when creating a new image");
 	}
+	if (image_size / block_size > UINT32_MAX)
+		fatal("image size too large for block size %u: %llu", block_size,
+			(unsigned long long)image_size);
+
+	if (max_memory > 0) {
+		if (direct_mode)
+			fatal("--max-memory cannot be used with --direct");
+		if (auto_size_mode || personalize_file || partition_count > 0
+			|| command == LFS_STORE)
+			fatal("--max-memory cannot be used with -s auto, --personalize, "
+				"--partition, or --store");
+	}
+	if (huge_pages_mode && max_memory == 0)
+		fatal("--huge-pages can only be used with --max-memory");
+	/* Load blocks on demand, when whole image is not needed in memory */
+	if (!direct_mode && !auto_size_mode && !personalize_file && command != LFS_STORE
+		&& !image_stream && !compress_mode && (max_memory > 0 || command == LFS_LIST
+			|| command == LFS_EXTRACT || command == LFS_CHANGESET))
+		paged_mode = 1;
+
+	if (!direct_mode && !paged_mode && image_size > SSIZE_MAX)
+		fatal("image size too large (use --direct): %llu",
+			(unsigned long long)image_size);
 
 	return optind;
 }
@@ -779,38 +2331,189 @@ int main(int argc, char **argv)
 	struct lfs_context *ctx;
 	param_t *params = NULL;
 	void *image_buf = NULL;
+	char *image_path = NULL;
+	struct container *cont = NULL;
+	struct personalize *personalize = NULL;
 	lfs_t lfs;
 	int fd = -1;
+	int out_fd = -1;
+	int tar_fd = -1;
 	int ret = 0;
 	int res;
 
 
 	parse_arguments(argc, argv);
 
+	if (command == LFS_DELTA || command == LFS_APPLY_DELTA) {
+		if (directory) {
+			if (chdir(directory))
+				fatal("cannot change directory to: %s", directory);
+		}
+		if (command == LFS_DELTA) {
+			if (argc - optind != 2)
+				fatal("old and new image files must be specified");
+			if (!overwrite_mode && file_exists(image_file))
+				fatal("patch file already exists: %s", image_file);
+			res = delta_create(argv[optind], argv[optind + 1], image_file, block_size,
+					image_offset, verbose_mode);
+		} else {
+			if (argc - optind != 1)
+				fatal("patch file must be specified");
+			res = delta_apply(image_file, argv[optind], image_offset, verbose_mode);
+		}
+		if (res)
+			fatal("%s: failed to %s delta (%d)", image_file,
+				(command == LFS_DELTA ? "create" : "apply"), res);
+		return 0;
+	}
+
+	if (command == LFS_SCAN)
+		return littlefs_scan(image_file);
+
+	if (command == LFS_SERVE)
+		return littlefs_serve(argc, argv);
+
+	/* Firmware file (UF2 or Intel HEX) is used instead of an image file */
+	if (command != LFS_CREATE && command != LFS_MATERIALIZE && !image_stream
+		&& !compress_mode && file_exists(image_file)
+		&& container_detect(image_file) > CONTAINER_NONE) {
+		if (direct_mode || max_memory > 0 || partition_count > 0 || auto_offset_mode
+			|| blank_map_file || shrink_mode)
+			fatal("firmware files cannot be used with --direct, --max-memory, "
+				"--partition, -o auto, --blank-map, or --shrink");
+		if ((res = container_load(image_file, &cont)))
+			fatal("%s: failed to load firmware file (%d)", image_file, res);
+		if (image_offset >= container_end(cont))
+			fatal("%s: no data at flash address 0x%08llx", image_file,
+				(unsigned long long)image_offset);
+		if (image_size == 0) {
+			/* Get filesystem size from the superblock, since blocks at the end
+			   of the filesystem are typically not present in the file */
+			struct lfs_superblock_info sb;
+			uint64_t len = container_end(cont) - image_offset;
+			void *buf;
+
+			if (len > CONTAINER_PROBE_SIZE)
+				len = CONTAINER_PROBE_SIZE;
+			if (!(buf = malloc(len)))
+				fatal("out of memory");
+			container_read(cont, image_offset, buf, len, erase_value);
+			if (lfs_parse_superblock(buf, len, &sb))
+				fatal("%s: no LittleFS filesystem found at flash address 0x%08llx",
+					image_file, (unsigned long long)image_offset);
+			free(buf);
+			block_size = sb.block_size;
+			image_size = (uint64_t)sb.block_size * sb.block_count;
+		}
+		if (image_offset + image_size > ((uint64_t)1 << 32))
+			fatal("%s: filesystem does not fit in 32-bit address space", image_file);
+		/* Only the filesystem is loaded (into memory) from the firmware file */
+		paged_mode = 0;
+	}
+
+	if (auto_offset_mode && command != LFS_MATERIALIZE) {
+		if ((res = find_offset(image_file)))
+			fatal("%s: no LittleFS filesystem found (%d)", image_file, res);
+	}
+
+	if (command == LFS_MATERIALIZE) {
+		if (file_exists(image_file) && image_offset == 0 && !overwrite_mode)
+			fatal("image file already exists: %s", image_file);
+		if (file_exists(image_file) && image_offset > 0)
+			fd = open_file(image_file, false);
+		else
+			fd = create_file(image_file, 0);
+		if (fd < 0)
+			fatal("cannot open image file: %s", image_file);
+		if (directory) {
+			if (chdir(directory))
+				fatal("cannot change directory to: %s", directory);
+		}
+		if ((res = materialize_image(store_dir, store_name(argc, argv), fd,
+							image_offset, verbose_mode)))
+			fatal("%s: failed to materialize image from store (%d)", image_file, res);
+		close(fd);
+		return 0;
+	}
+
 	/* Open image file */
-	if (!file_exists(image_file)) {
+	if (image_stream) {
+		if (command == LFS_CREATE || command == LFS_UPDATE || command == LFS_DELETE) {
+			/* Keep stdout for the image, and send all other output to stderr */
+			if (isatty(STDOUT_FILENO))
+				fatal("refusing to write image to a terminal");
+			if ((out_fd = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+				fatal("cannot redirect standard output");
+		}
+		if (command != LFS_CREATE) {
+			if ((res = littlefs_read_stream(STDIN_FILENO, &image_buf)))
+				fatal("failed to read image from stdin (%d)", res);
+		}
+	}
+	else if (!file_exists(image_file)) {
 		if (command != LFS_CREATE)
 			fatal("image file not found: %s", image_file);
-		if ((fd = create_file(image_file, image_size + image_offset)) < 0)
+		if ((fd = create_file(image_file, (auto_size_mode || compress_mode ? 0 : image_size)
+							+ image_offset)) < 0)
 			fatal("cannot create image file: %s", image_file);
 	}
-	else {
+	else if (compress_mode && command != LFS_CREATE) {
+		/* Whole image is decompressed into memory */
+		if ((fd = open_file(image_file, true)) < 0)
+			fatal("cannot open image file: %s", image_file);
+		if ((res = littlefs_read_stream(fd, &image_buf)))
+			fatal("%s: failed to read compressed image (%d)", image_file, res);
+		close(fd);
+		fd = -1;
+	}
+	else if (!cont) {
 		if (!overwrite_mode && command == LFS_CREATE)
 			fatal("image file already exists: %s", image_file);
 
-		if ((fd = open_file(image_file, (command == LFS_LIST ? true : false))) < 0)
+		if ((fd = open_file(image_file, (command == LFS_LIST || command == LFS_CHANGESET
+						|| command == LFS_STORE ? true : false))) < 0)
 			fatal("cannot open image file: %s", image_file);
 
 		if (command == LFS_CREATE) {
 			off_t sz = file_size(fd);
 			if (sz < 0)
 				fatal("cannot determine file size: %s", image_file);
-			if (direct_mode && sz < (off_t)image_offset + (off_t)image_size) {
+			if ((direct_mode || paged_mode) && erase_value == 0
+				&& sz < (off_t)image_offset + (off_t)image_size) {
 				if ((res = file_set_zero(fd, image_offset, image_size)))
 					fatal("failed to zero-out lfs image");
 			}
 		}
 	}
+	if (command == LFS_CREATE && (direct_mode || paged_mode) && erase_value != 0) {
+		/* Blocks that are never written must read as erased flash */
+		if ((res = file_set_value(fd, image_offset, image_size, erase_value)))
+			fatal("failed to erase lfs image");
+	}
+
+	/* Open tar file to add files from (or to extract files to) */
+	if (tar_file) {
+		if (!strcmp(tar_file, "-"))
+			tar_fd = STDIN_FILENO;
+		else if ((tar_fd = open_file(tar_file, true)) < 0)
+			fatal("cannot open tar file: %s", tar_file);
+	}
+	if (to_tar_file) {
+		if (!strcmp(to_tar_file, "-"))
+			tar_out_fd = STDOUT_FILENO;
+		else if ((tar_out_fd = create_file(to_tar_file, 0)) < 0)
+			fatal("cannot create tar file: %s", to_tar_file);
+	}
+
+	/* Manifest (and paths listed in it) are relative to current directory */
+	if (personalize_file && !(personalize = personalize_load(personalize_file)))
+		fatal("%s: failed to read manifest file", personalize_file);
+
+	/* Firmware (and compressed) image file is replaced with a new file
+	   after changing directory */
+	if ((cont || (compress_mode && !image_stream))
+		&& !(image_path = absolute_path(image_file)))
+		fatal("%s: cannot determine path of image file", image_file);
 
 	/* Change directory if -C, --directory option specified. */
 	if (directory) {
@@ -818,22 +2521,46 @@ int main(int argc, char **argv)
 			fatal("cannot change directory to: %s", directory);
 	}
 
+	if (partition_count > 0) {
+		bool filecheck = (command == LFS_UPDATE && !stdin_mode);
+
+		if ((res = parse_params(argc, argv, optind, &params, filecheck))) {
+			warn("failed to parse all parameters: %d", res);
+			ret = 2;
+		}
+		if ((res = littlefs_partitions(fd, params)))
+			ret = res;
+		close(fd);
+		return ret;
+	}
+
 	/* Initialize LittleFS library */
+	ssize_t bufsize = image_size;
+
+	if (bufsize == 0) {
+		if ((bufsize = file_size(fd)) < 0)
+			fatal("%s: cannot get file image file size", image_file);
+		bufsize -= image_offset;
+		if (bufsize < 0)
+			fatal("invalid offset: %llu", (unsigned long long)image_offset);
+	}
 	if (direct_mode) {
 		ctx = lfs_init_file(fd, image_offset, image_size, block_size);
+	} else if (paged_mode) {
+		ctx = lfs_init_paged(fd, image_offset, image_size, block_size, max_memory,
+				huge_pages_mode);
+	} else if (image_buf) {
+		/* Image was already read from stdin (or decompressed) */
+		ctx = lfs_init_mem(image_buf, image_size, block_size);
 	} else {
-		ssize_t bufsize = image_size;
-
-		if (bufsize == 0) {
-			if ((bufsize = file_size(fd)) < 0)
-				fatal("%s: cannot get file image file size", image_file);
-			bufsize -= image_offset;
-			if (bufsize < 0)
-				fatal("invalid offset: %ld", image_offset);
-		}
 		if (!(image_buf = calloc(1, bufsize)))
 			fatal("out of memory");
-		if (command != LFS_CREATE) {
+		if (command == LFS_CREATE && erase_value != 0)
+			memset(image_buf, erase_value, bufsize);
+		if (cont) {
+			container_read(cont, image_offset, image_buf, bufsize, erase_value);
+		}
+		else if (command != LFS_CREATE) {
 			if ((res = read_file(fd, image_offset, image_buf, bufsize)))
 				fatal("%s: failed to read image from file (%d)", image_file, errno);
 		}
@@ -841,6 +2568,7 @@ int main(int argc, char **argv)
 	}
 	if (!ctx)
 		fatal("failed to initialize LittleFS");
+	lfs_set_erase_value(ctx, erase_value);
 
 	if (command == LFS_CREATE) {
 		/* Make new filesystem */
@@ -849,38 +2577,40 @@ int main(int argc, char **argv)
 	}
 
 	/* Mount LittleFS */
-	if ((res = littlefs_mount(ctx, &lfs)))
+	if ((res = littlefs_mount(ctx, &lfs, bufsize)))
 		fatal("%s: failed to mount LittleFS (%d)", image_file, res);
 
 	if (image_size == 0) {
 		ctx->cfg.block_count = lfs.block_count;
-		image_size = block_size * lfs.block_count;
+		image_size = (uint64_t)block_size * lfs.block_count;
 	} else {
-		uint32_t new_size = block_size * lfs.block_count;
+		uint64_t new_size = (uint64_t)block_size * lfs.block_count;
 		if (image_size != new_size)
-			warn("specified image size does not match filesystem: %u vs %u",
-				image_size, new_size);
+			warn("specified image size does not match filesystem: %llu vs %llu",
+				(unsigned long long)image_size, (unsigned long long)new_size);
 	}
 
-	if (verbose_mode > 1 && !stdout_mode) {
+	if (verbose_mode > 1 && !stdout_mode && !auto_size_mode) {
 		lfs_size_t used_blocks = lfs_fs_size(&lfs);
 
-		printf("Filesystem size: %10u bytes (%u blocks)\n", block_size * lfs.block_count,
-			lfs.block_count);
-		printf("           used: %10u bytes (%u blocks)\n", block_size * used_blocks,
-			used_blocks);
-		printf("           free: %10u bytes (%u blocks)\n\n",
-			block_size * (lfs.block_count - used_blocks), lfs.block_count - used_blocks);
+		printf("Filesystem size: %10llu bytes (%u blocks)\n",
+			(unsigned long long)block_size * lfs.block_count, lfs.block_count);
+		printf("           used: %10llu bytes (%u blocks)\n",
+			(unsigned long long)block_size * used_blocks, used_blocks);
+		printf("           free: %10llu bytes (%u blocks)\n\n",
+			(unsigned long long)block_size * (lfs.block_count - used_blocks),
+			lfs.block_count - used_blocks);
 		printf("      blocksize: %10u bytes\n\n", block_size);
 	}
 
 
 
-	/* Parse command parameters */
+	/* Parse command parameters (new image/directory for changeset is a host path) */
 	bool filecheck = false;
 	if ((command == LFS_CREATE || command == LFS_UPDATE) && !stdin_mode)
 		filecheck = true;
-	if ((res = parse_params(argc, argv, optind, &params, filecheck))) {
+	if (command != LFS_CHANGESET
+		&& (res = parse_params(argc, argv, optind, &params, filecheck))) {
 		warn("failed to parse all parameters: %d", res);
 		ret = 2;
 	}
@@ -894,6 +2624,8 @@ int main(int argc, char **argv)
 		if (littlefs_list(&lfs, "./", true, params, false,
 					command == LFS_EXTRACT ? true : false) > 0)
 			ret = 1;
+		if (tar_out_fd >= 0 && lfs_tar_finish(tar_out_fd))
+			fatal("%s: failed to write tar file", to_tar_file);
 		param_t *p = params;
 		while (p) {
 			if (!p->found) {
@@ -906,8 +2638,18 @@ int main(int argc, char **argv)
 
 	case LFS_CREATE:
 	case LFS_UPDATE:
-		if (littlefs_add(&lfs, params, true))
+		if (sync_dir) {
+			if (littlefs_sync(&lfs, sync_dir))
+				ret = 1;
+		}
+		else if (tar_file) {
+			if (lfs_tar_import(&lfs, tar_fd, (auto_size_mode ? auto_size_reserve_path : NULL),
+						verbose_mode))
+				ret = 1;
+		}
+		else if (littlefs_add(&lfs, params, true)) {
 			ret = 1;
+		}
 		break;
 
 	case LFS_DELETE:
@@ -915,20 +2657,84 @@ int main(int argc, char **argv)
 			ret = 1;
 		break;
 
+	case LFS_CHANGESET:
+		if (littlefs_changeset(&lfs, argv[optind], changeset_file))
+			ret = 1;
+		break;
+
+	case LFS_STORE:
+		if (store_image(store_dir, store_name(argc, argv), image_buf, block_size,
+					lfs.block_count, verbose_mode))
+			ret = 1;
+		break;
+
 	default:
 		fatal("internal error");
 
 	}
 
 
+	if (auto_size_mode) {
+		if (ret == 0 && (res = auto_size_finalize(&lfs)))
+			fatal("%s: failed to determine filesystem size (%d)", image_file, res);
+		/* Image buffer may have been reallocated while growing the filesystem */
+		image_buf = ctx->base;
+		image_size = (uint64_t)block_size * lfs.block_count;
+		if (verbose_mode > 1)
+			printf("Filesystem size: %10llu bytes (%u blocks)\n",
+				(unsigned long long)image_size, lfs.block_count);
+	}
+
+	if (finalize_mode) {
+		if ((res = littlefs_finalize(ctx, &lfs)))
+			fatal("%s: failed to finalize LittleFS (%d)", image_file, res);
+	}
+
+	if (index_file && ret == 0) {
+		if ((res = littlefs_write_index(&lfs, index_file)))
+			fatal("%s: failed to write file index (%d)", index_file, res);
+	}
+
+	uint32_t *used_map = NULL;
+	lfs_size_t block_count = lfs.block_count;
+	if (uf2_file || ihex_file || cont) {
+		if (!(used_map = lfs_fs_block_bitmap(&lfs)))
+			fatal("%s: failed to get list of used blocks", image_file);
+	}
+
 	/* Unmount LittleFS */
 	if ((res = lfs_unmount(&lfs)) != LFS_ERR_OK)
 		fatal("%s: failed to unmount LittleFS (%d)", image_file, res);
 
-	if (command != LFS_LIST) {
-		if (!direct_mode) {
-			/* Write image from memory to the image file */
-			if ((res = write_file(fd, image_offset, image_buf, image_size)))
+	if (command != LFS_LIST && command != LFS_CHANGESET && command != LFS_STORE) {
+		if (cont) {
+			if (command != LFS_EXTRACT && (res = littlefs_container_write(image_path,
+									cont, image_buf, block_count, used_map)))
+				fatal("%s: failed to write firmware file (%d)", image_file, res);
+		}
+		else if (image_stream) {
+			if (out_fd >= 0 && compress_mode) {
+				if ((res = compress_write(out_fd, compress_mode, image_buf, image_size)))
+					fatal("failed to write compressed image to stdout (%d)", res);
+			}
+			else if (out_fd >= 0 && (res = write_file(out_fd, -1, image_buf, image_size)))
+				fatal("failed to write image to stdout (%d)", errno);
+		}
+		else if (compress_mode) {
+			if (command != LFS_EXTRACT && (res = littlefs_compress_write(image_path,
+									image_buf)))
+				fatal("%s: failed to write compressed image (%d)", image_file, res);
+		}
+		else if (paged_mode) {
+			/* Write modified blocks back to the image file */
+			if ((res = lfs_flush(ctx)))
+				fatal("%s: failed to write image to file (%d)", image_file, res);
+		}
+		else if (!direct_mode) {
+			/* Write image from memory to the image file (erased blocks are not
+			   written, so that they don't allocate space in the file) */
+			if ((res = write_file_sparse(fd, image_offset, image_buf, image_size,
+								block_size)))
 				fatal("%s: failed to write image to file (%d)", image_file, errno);
 		}
 		if (shrink_mode) {
@@ -942,8 +2748,49 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (blank_map_file) {
+		if ((res = littlefs_blank_map(fd, blank_map_file)))
+			fatal("%s: failed to write blank region map (%d)", blank_map_file, res);
+	}
+
+	if (uf2_file || ihex_file) {
+		struct export_image img = {
+			.fd = fd,
+			.offset = image_offset,
+			.buf = (direct_mode || paged_mode ? NULL : image_buf),
+			.block_size = block_size,
+			.block_count = block_count,
+			.used = used_map,
+			.erase_value = erase_value,
+			.base_address = base_address,
+			.family_id = family_id,
+		};
+
+		if (uf2_file && (res = export_uf2(uf2_file, &img, verbose_mode)))
+			fatal("%s: failed to export UF2 file (%d)", uf2_file, res);
+		if (ihex_file && (res = export_ihex(ihex_file, &img, verbose_mode)))
+			fatal("%s: failed to export Intel HEX file (%d)", ihex_file, res);
+	}
+	free(used_map);
+
+	if (personalize && ret == 0) {
+		if ((res = personalize_images(personalize, image_buf, image_size, block_size,
+							erase_value, verbose_mode)))
+			fatal("%s: failed to create personalized images (%d)",
+				personalize_file, res);
+	}
+
 	if (fd >= 0)
 		close(fd);
+	if (tar_fd > STDIN_FILENO)
+		close(tar_fd);
+	if (tar_out_fd > STDOUT_FILENO && close(tar_out_fd))
+		fatal("%s: failed to write tar file (%d)", to_tar_file, errno);
+	if (out_fd >= 0 && close(out_fd))
+		fatal("failed to write image to stdout (%d)", errno);
+	container_free(cont);
+	personalize_free(personalize);
+	free(image_path);
 	lfs_destroy_context(ctx);
 
 	return ret;
@@ -35,7 +35,14 @@ enum lfs_commands {
 	LFS_CREATE = 2,
 	LFS_UPDATE = 3,
 	LFS_DELETE = 4,
-	LFS_EXTRACT = 5
+	LFS_EXTRACT = 5,
+	LFS_DELTA = 6,
+	LFS_APPLY_DELTA = 7,
+	LFS_CHANGESET = 8,
+	LFS_STORE = 9,
+	LFS_MATERIALIZE = 10,
+	LFS_SCAN = 11,
+	LFS_SERVE = 12
 };
 
 typedef struct param_t {
@@ -49,8 +56,12 @@ typedef struct param_t {
 int create_file(const char *name, off_t size);
 int open_file(const char *name, bool readonly);
 int file_set_zero(int fd, off_t offset, off_t size);
+int file_set_value(int fd, off_t offset, off_t size, uint8_t value);
+int read_stream(int fd, void **buf, size_t *size);
 int read_file(int fd, off_t offset, void *buf, size_t size);
 int write_file(int fd, off_t offset, void *buf, size_t size);
+int write_file_sparse(int fd, off_t offset, void *buf, size_t size, size_t block_size);
+bool is_blank_buf(const void *buf, size_t size, uint8_t value);
 off_t file_size(int fd);
 int is_directory(const char *path);
 int is_file(const char *filename, struct stat *st);
@@ -58,12 +69,28 @@ int file_exists(const char *pathname);
 int rename_file(const char *old_path, const char *new_path);
 int mkdir_parent(const char *pathname, mode_t mode);
 char *trim_str(char *s);
+char *absolute_path(const char *path);
 char *splitdir(const char *filename);
+int match_pattern(const char *pattern, const char *str);
 int parse_int_str(const char *str, int64_t *val, int64_t min, int64_t max);
 void fatal(const char *format, ...);
 void warn(const char *format, ...);
-const char* warn_last_msg();
-void warn_clear_last_msg();
-void warn_mode(bool enabled);
+
+/* delta.c */
+int delta_create(const char *old_file, const char *new_file, const char *patch_file,
+		size_t block_size, off_t offset, bool verbose);
+int delta_apply(const char *image_file, const char *patch_file, off_t offset, bool verbose);
+
+/* store.c */
+int store_image(const char *store_dir, const char *name, const void *image,
+		size_t block_size, size_t block_count, bool verbose);
+int materialize_image(const char *store_dir, const char *name, int fd, off_t offset,
+		bool verbose);
+
+/* personalize.c */
+struct personalize* personalize_load(const char *manifest);
+void personalize_free(struct personalize *p);
+int personalize_images(struct personalize *p, const void *base, size_t size,
+		size_t block_size, uint8_t erase_value, bool verbose);
 
 #endif /* LITTLEFS_TOY_H */
@@ -0,0 +1,364 @@
+/* personalize.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Create personalized copies of a base image.
+ *
+ * Manifest file contains one line per image to create:
+ *
+ *   <output image file> <directory>
+ *
+ * Contents of the directory are added to a copy-on-write clone of the base
+ * image, so each clone only allocates memory for the blocks it modifies.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <lfs.h>
+
+#include "lfs_driver.h"
+#include "lfs_extra.h"
+#include "littlefs-toy.h"
+
+#define PERSONALIZE_MAX_THREADS 8
+
+
+struct unit {
+	char *image;
+	char *dir;
+};
+
+struct personalize {
+	const void *base;
+	size_t size;
+	size_t block_size;
+	uint8_t erase_value;
+	bool verbose;
+
+	struct unit *units;
+	size_t count;
+	size_t alloc;
+
+	pthread_mutex_t mutex;
+	size_t next;
+	int errors;
+};
+
+
+static int parse_manifest(struct personalize *p, const char *manifest)
+{
+	FILE *fp;
+	char line[8192];
+	int lineno = 0;
+	int res = 0;
+
+
+	if (!(fp = fopen(manifest, "r"))) {
+		warn("%s: cannot open manifest file", manifest);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *s = trim_str(line);
+		char *dir;
+
+		lineno++;
+		if (*s == 0 || *s == '#')
+			continue;
+
+		dir = s;
+		while (*dir && !isspace((unsigned char)*dir))
+			dir++;
+		if (*dir)
+			*dir++ = 0;
+		dir = trim_str(dir);
+		if (*dir == 0) {
+			warn("%s:%d: directory missing", manifest, lineno);
+			res = -2;
+			break;
+		}
+
+		if (p->count >= p->alloc) {
+			size_t alloc = (p->alloc ? p->alloc * 2 : 64);
+			struct unit *u;
+
+			if (!(u = realloc(p->units, alloc * sizeof(struct unit)))) {
+				res = -3;
+				break;
+			}
+			p->units = u;
+			p->alloc = alloc;
+		}
+		/* Paths are relative to the current directory (before -C) */
+		p->units[p->count].image = absolute_path(s);
+		p->units[p->count].dir = absolute_path(dir);
+		p->count++;
+		if (!p->units[p->count - 1].image || !p->units[p->count - 1].dir) {
+			res = -3;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return res;
+}
+
+
+static int add_file(lfs_t *lfs, const char *src, const char *dst, off_t size)
+{
+	lfs_file_t file;
+	void *buf;
+	int fd, res = 0;
+
+
+	/* Files are small, so whole file is read into memory */
+	if ((fd = open_file(src, true)) < 0)
+		return -1;
+	if (!(buf = malloc(size > 0 ? size : 1))) {
+		close(fd);
+		return -2;
+	}
+	if (size > 0 && read_file(fd, 0, buf, size))
+		res = -3;
+	close(fd);
+
+	if (res == 0 && (res = lfs_file_open(lfs, &file, dst, LFS_O_WRONLY | LFS_O_CREAT
+							| LFS_O_TRUNC)) == LFS_ERR_OK) {
+		if (size > 0 && lfs_file_write(lfs, &file, buf, size) < (lfs_ssize_t)size)
+			res = LFS_ERR_NOSPC;
+		if (lfs_file_close(lfs, &file) != LFS_ERR_OK && res == LFS_ERR_OK)
+			res = LFS_ERR_IO;
+		if (res == LFS_ERR_OK)
+			res = lfs_clear_attr(lfs, dst, LFST_ATTR_CRC);
+	}
+	free(buf);
+
+	return res;
+}
+
+
+/* Copy contents of a (host) directory into the filesystem */
+static int add_dir(lfs_t *lfs, const char *srcpath, const char *dstpath)
+{
+	DIR *dir;
+	struct dirent *e;
+	struct stat st;
+	char *src, *dst;
+	int res = 0;
+
+
+	if (!(dir = opendir(srcpath))) {
+		warn("%s: failed to open directory", srcpath);
+		return -1;
+	}
+	while (res == 0 && (e = readdir(dir))) {
+		size_t len = strlen(e->d_name);
+
+		/* Skip special directories ("." and "..") */
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+
+		src = malloc(strlen(srcpath) + len + 2);
+		dst = malloc(strlen(dstpath) + len + 2);
+		if (!src || !dst) {
+			free(src);
+			free(dst);
+			res = -2;
+			break;
+		}
+		sprintf(src, "%s/%s", srcpath, e->d_name);
+		sprintf(dst, "%s%s%s", dstpath, (*dstpath ? "/" : ""), e->d_name);
+
+		if (lstat(src, &st)) {
+			warn("cannot stat file: %s", src);
+			res = -3;
+		}
+		else if (S_ISDIR(st.st_mode)) {
+			if ((res = lfs_mkdir(lfs, dst)) == LFS_ERR_EXIST)
+				res = LFS_ERR_OK;
+			if (res == LFS_ERR_OK)
+				res = add_dir(lfs, src, dst);
+		}
+		else if (S_ISREG(st.st_mode)) {
+			res = add_file(lfs, src, dst, st.st_size);
+		}
+		else {
+			warn("%s: skip special file", src);
+		}
+		free(src);
+		free(dst);
+	}
+	closedir(dir);
+
+	return res;
+}
+
+
+static int personalize_unit(struct personalize *p, const struct unit *u)
+{
+	struct lfs_context *ctx;
+	lfs_t lfs;
+	int fd, res;
+
+
+	if (!(ctx = lfs_init_cow(p->base, p->size, p->block_size)))
+		return -1;
+	lfs_set_erase_value(ctx, p->erase_value);
+
+	if ((res = lfs_mount(&lfs, &ctx->cfg)) != LFS_ERR_OK) {
+		lfs_destroy_context(ctx);
+		return -2;
+	}
+
+	res = add_dir(&lfs, u->dir, "");
+	if (lfs_unmount(&lfs) != LFS_ERR_OK && res == 0)
+		res = -4;
+
+	if (res == 0) {
+		if ((fd = create_file(u->image, 0)) < 0) {
+			res = -5;
+		} else {
+			if (lfs_write_image(ctx, fd, 0))
+				res = -6;
+			close(fd);
+		}
+	}
+	lfs_destroy_context(ctx);
+
+	return res;
+}
+
+
+static void* personalize_thread(void *arg)
+{
+	struct personalize *p = (struct personalize*)arg;
+	struct unit *u;
+	int res;
+
+	while (1) {
+		pthread_mutex_lock(&p->mutex);
+		u = (p->next < p->count ? &p->units[p->next++] : NULL);
+		pthread_mutex_unlock(&p->mutex);
+		if (!u)
+			break;
+
+		if ((res = personalize_unit(p, u))) {
+			warn("%s: failed to create personalized image (%d)", u->image, res);
+			pthread_mutex_lock(&p->mutex);
+			p->errors++;
+			pthread_mutex_unlock(&p->mutex);
+		}
+		else if (p->verbose) {
+			printf("%s\n", u->image);
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Read manifest file (paths in the manifest are resolved immediately) */
+struct personalize* personalize_load(const char *manifest)
+{
+	struct personalize *p;
+
+	if (!manifest)
+		return NULL;
+	if (!(p = calloc(1, sizeof(struct personalize))))
+		return NULL;
+	if (parse_manifest(p, manifest)) {
+		personalize_free(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+
+void personalize_free(struct personalize *p)
+{
+	if (!p)
+		return;
+	for (size_t i = 0; i < p->count; i++) {
+		free(p->units[i].image);
+		free(p->units[i].dir);
+	}
+	free(p->units);
+	free(p);
+}
+
+
+int personalize_images(struct personalize *p, const void *base, size_t size,
+		size_t block_size, uint8_t erase_value, bool verbose)
+{
+	pthread_t threads[PERSONALIZE_MAX_THREADS];
+	int thread_count = 2;
+	int res = 0;
+	int i;
+
+
+	if (!p || !base)
+		return -1;
+
+	p->base = base;
+	p->size = size;
+	p->block_size = block_size;
+	p->erase_value = erase_value;
+	p->verbose = verbose;
+	p->next = 0;
+	p->errors = 0;
+	pthread_mutex_init(&p->mutex, NULL);
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((thread_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		thread_count = 1;
+	if (thread_count > PERSONALIZE_MAX_THREADS)
+		thread_count = PERSONALIZE_MAX_THREADS;
+#endif
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&threads[i], NULL, personalize_thread, p)) {
+			thread_count = i;
+			break;
+		}
+	}
+	if (thread_count < 1)
+		res = -2;
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	if (res == 0 && p->errors > 0)
+		res = -3;
+	pthread_mutex_destroy(&p->mutex);
+
+	return res;
+}
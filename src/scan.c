@@ -0,0 +1,174 @@
+/* scan.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE /* for memmem() */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <lfs.h>
+
+#include "lfs_driver.h"
+#include "scan.h"
+#include "littlefs-toy.h"
+
+/* Superblock magic is stored at offset 8 of a metadata block */
+#define SCAN_MAGIC "littlefs"
+#define SCAN_MAGIC_OFFSET 8
+/* Smallest block size supported by littlefs */
+#define SCAN_ALIGN 128
+#define SCAN_MAX_BLOCK_SIZE (1024 * 1024)
+
+
+static const uint8_t* find_magic(const uint8_t *buf, size_t len)
+{
+#ifdef HAVE_MEMMEM
+	return memmem(buf, len, SCAN_MAGIC, sizeof(SCAN_MAGIC) - 1);
+#else
+	const uint8_t *end = buf + len;
+	const uint8_t *p = buf;
+
+	while (p + sizeof(SCAN_MAGIC) - 1 <= end) {
+		if (!(p = memchr(p, SCAN_MAGIC[0], end - p)))
+			break;
+		if (p + sizeof(SCAN_MAGIC) - 1 <= end
+			&& !memcmp(p, SCAN_MAGIC, sizeof(SCAN_MAGIC) - 1))
+			return p;
+		p++;
+	}
+	return NULL;
+#endif
+}
+
+
+static int add_result(struct scan_result **results, size_t *count, size_t *alloc,
+		off_t offset, const struct lfs_superblock_info *info)
+{
+	struct scan_result *r;
+
+	if (*count >= *alloc) {
+		size_t n = (*alloc ? *alloc * 2 : 8);
+
+		if (!(r = realloc(*results, n * sizeof(struct scan_result))))
+			return -1;
+		*results = r;
+		*alloc = n;
+	}
+
+	r = &(*results)[(*count)++];
+	r->offset = offset;
+	r->block_size = info->block_size;
+	r->block_count = info->block_count;
+	r->version = info->version;
+
+	return 0;
+}
+
+
+int scan_image(const char *image_file, struct scan_result **results, size_t *count)
+{
+	struct lfs_superblock_info info;
+	const uint8_t *buf, *p;
+	size_t alloc = 0;
+	off_t size, pos = 0;
+	int fd, res = 0;
+
+
+	if (!image_file || !results || !count)
+		return -1;
+	*results = NULL;
+	*count = 0;
+
+	if ((fd = open_file(image_file, true)) < 0)
+		return -2;
+	if ((size = file_size(fd)) < 0) {
+		close(fd);
+		return -3;
+	}
+	if (size < SCAN_ALIGN) {
+		close(fd);
+		return 0;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		close(fd);
+		return -4;
+	}
+	madvise((void*)buf, size, MADV_SEQUENTIAL);
+#else
+	if (!(buf = malloc(size)) || read_file(fd, 0, (void*)buf, size)) {
+		free((void*)buf);
+		close(fd);
+		return -4;
+	}
+#endif
+	close(fd);
+
+	while (pos < size && (p = find_magic(buf + pos, size - pos))) {
+		off_t block = (p - buf) - SCAN_MAGIC_OFFSET;
+
+		pos = (p - buf) + 1;
+		/* Metadata blocks are always aligned (at least) to smallest block size */
+		if (block < 0 || block % SCAN_ALIGN != 0)
+			continue;
+		if (lfs_parse_superblock(buf + block, (size - block > SCAN_MAX_BLOCK_SIZE ?
+						SCAN_MAX_BLOCK_SIZE : size - block), &info))
+			continue;
+
+		/* Skip second block of the superblock pair of previous filesystem */
+		if (*count > 0) {
+			struct scan_result *prev = &(*results)[*count - 1];
+
+			if (prev->block_size == info.block_size
+				&& prev->offset + (off_t)info.block_size == block)
+				continue;
+		}
+		if ((res = add_result(results, count, &alloc, block, &info)))
+			break;
+		/* No other superblocks can be inside this block */
+		pos = block + info.block_size;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	munmap((void*)buf, size);
+#else
+	free((void*)buf);
+#endif
+
+	if (res) {
+		free(*results);
+		*results = NULL;
+		*count = 0;
+	}
+
+	return res;
+}
@@ -0,0 +1,657 @@
+/* serve.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serve LittleFS images over a Unix domain socket.
+ *
+ * Images are kept mounted in memory, so requests (list, read, write, delete)
+ * are handled without re-reading and re-mounting the image each time.
+ * Modified blocks are written back to the image files when flush is
+ * requested, when the server has been idle for a while, and on shutdown.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_UN_H
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#endif
+#include <lfs.h>
+
+#include "lfs_driver.h"
+#include "lfs_extra.h"
+#include "serve.h"
+#include "littlefs-toy.h"
+
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_MAX_IMAGES 256
+#define SERVE_MAX_DATA (256 * 1024 * 1024)
+#define SERVE_IDLE_FLUSH_MS 1000
+#define SERVE_READ_SIZE (64 * 1024)
+#define SERVE_KEEP_BUF_SIZE (1024 * 1024)
+
+
+#ifdef HAVE_SYS_UN_H
+struct serve_image {
+	const char *filename;
+	int fd;
+	void *buf;
+	struct lfs_context *ctx;
+	lfs_t lfs;
+	bool mounted;
+};
+
+struct serve_buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct serve_client {
+	int fd;
+	struct serve_buf in;   /* received (partial) requests */
+	struct serve_buf out;  /* responses not yet sent */
+	size_t out_pos;
+};
+
+static const char *op_names[] = {
+	"?", "list", "read", "write", "delete", "flush", "shutdown"
+};
+
+static volatile sig_atomic_t serve_stop = 0;
+
+
+static void serve_signal(int sig)
+{
+	(void)sig;
+	serve_stop = 1;
+}
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+
+static int buf_reserve(struct serve_buf *b, size_t len)
+{
+	if (b->len + len > b->alloc) {
+		size_t alloc = (b->alloc ? b->alloc : 4096);
+		uint8_t *p;
+
+		while (alloc < b->len + len)
+			alloc *= 2;
+		if (!(p = realloc(b->data, alloc)))
+			return LFS_ERR_NOMEM;
+		b->data = p;
+		b->alloc = alloc;
+	}
+
+	return LFS_ERR_OK;
+}
+
+
+static int buf_append(struct serve_buf *b, const void *data, size_t len)
+{
+	int res;
+
+	if ((res = buf_reserve(b, len)))
+		return res;
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return LFS_ERR_OK;
+}
+
+
+/* Release buffer if it has grown large (after a big request/response) */
+static void buf_trim(struct serve_buf *b)
+{
+	if (b->len == 0 && b->alloc > SERVE_KEEP_BUF_SIZE) {
+		free(b->data);
+		b->data = NULL;
+		b->alloc = 0;
+	}
+}
+
+
+static int load_image(struct serve_image *img, uint8_t erase_value)
+{
+	struct lfs_superblock_info sb;
+	size_t size;
+	off_t len;
+
+
+	if ((img->fd = open_file(img->filename, false)) < 0)
+		return -1;
+	if ((len = file_size(img->fd)) <= 0)
+		return -2;
+	if (!(img->buf = malloc(len)))
+		return -3;
+	if (read_file(img->fd, 0, img->buf, len))
+		return -4;
+	if (lfs_parse_superblock(img->buf, len, &sb))
+		return -5;
+	size = (size_t)sb.block_size * sb.block_count;
+	if (size > (size_t)len)
+		return -6;
+
+	if (!(img->ctx = lfs_init_mem(img->buf, size, sb.block_size)))
+		return -7;
+	lfs_set_erase_value(img->ctx, erase_value);
+	if (lfs_track_dirty(img->ctx))
+		return -8;
+	if (lfs_mount(&img->lfs, &img->ctx->cfg) != LFS_ERR_OK)
+		return -9;
+	img->mounted = true;
+
+	return 0;
+}
+
+
+static int flush_images(struct serve_image *images, size_t count)
+{
+	int res = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (!images[i].mounted)
+			continue;
+		if (lfs_write_dirty(images[i].ctx, images[i].fd, 0)) {
+			warn("%s: failed to write image to file", images[i].filename);
+			res = -1;
+		}
+	}
+
+	return res;
+}
+
+
+static int op_list(lfs_t *lfs, const char *path, struct serve_buf *out)
+{
+	struct lfs_info info;
+	lfs_dir_t dir;
+	uint8_t hdr[7];
+	int res;
+
+
+	if ((res = lfs_dir_open(lfs, &dir, path)) != LFS_ERR_OK)
+		return res;
+	while ((res = lfs_dir_read(lfs, &dir, &info)) > 0) {
+		size_t len = strlen(info.name);
+
+		if (!strcmp(info.name, ".") || !strcmp(info.name, ".."))
+			continue;
+		hdr[0] = (info.type == LFS_TYPE_DIR ? SERVE_TYPE_DIR : SERVE_TYPE_FILE);
+		put_u32(hdr + 1, info.size);
+		hdr[5] = len & 0xff;
+		hdr[6] = (len >> 8) & 0xff;
+		if ((res = buf_append(out, hdr, sizeof(hdr)))
+			|| (res = buf_append(out, info.name, len)))
+			break;
+	}
+	lfs_dir_close(lfs, &dir);
+
+	return (res < 0 ? res : LFS_ERR_OK);
+}
+
+
+static int op_read(lfs_t *lfs, const char *path, struct serve_buf *out)
+{
+	struct lfs_info info;
+	lfs_file_t file;
+	lfs_ssize_t len;
+	int res;
+
+
+	if ((res = lfs_stat(lfs, path, &info)) != LFS_ERR_OK)
+		return res;
+	if (info.type == LFS_TYPE_DIR)
+		return LFS_ERR_ISDIR;
+	if ((res = buf_reserve(out, info.size)))
+		return res;
+
+	if ((res = lfs_file_open(lfs, &file, path, LFS_O_RDONLY)) != LFS_ERR_OK)
+		return res;
+	if ((len = lfs_file_read(lfs, &file, out->data + out->len, info.size)) >= 0)
+		out->len += len;
+	res = lfs_file_close(lfs, &file);
+
+	return (len < 0 ? len : res);
+}
+
+
+static int op_write(lfs_t *lfs, const char *path, const void *data, size_t size)
+{
+	lfs_file_t file;
+	lfs_ssize_t len;
+	char *dir;
+	int res;
+
+
+	/* Create parent directories as needed */
+	if ((dir = splitdir(path))) {
+		res = (*dir ? lfs_mkdir_parent(lfs, dir) : LFS_ERR_OK);
+		free(dir);
+		if (res != LFS_ERR_OK)
+			return res;
+	}
+
+	if ((res = lfs_file_open(lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT
+						| LFS_O_TRUNC)) != LFS_ERR_OK)
+		return res;
+	len = lfs_file_write(lfs, &file, data, size);
+	res = lfs_file_close(lfs, &file);
+
+	if (len < 0)
+		return len;
+	if ((size_t)len != size)
+		return LFS_ERR_NOSPC;
+	if (res == LFS_ERR_OK)
+		res = lfs_clear_attr(lfs, path, LFST_ATTR_CRC);
+
+	return res;
+}
+
+
+static int op_delete(lfs_t *lfs, const char *path)
+{
+	int res = lfs_remove(lfs, path);
+
+	if (res == LFS_ERR_NOTEMPTY)
+		res = lfs_rmdir_recursive(lfs, path);
+
+	return res;
+}
+
+
+/* Check if buffer starts with a complete request, returns 1 if it does
+   (and sets size of the request), 0 if more data is needed */
+static int request_size(const uint8_t *buf, size_t len, size_t *size)
+{
+	if (len < SERVE_REQUEST_SIZE)
+		return 0;
+	if (get_u32(buf) != SERVE_MAGIC)
+		return -1;
+	if (get_u32(buf + 8) > SERVE_MAX_DATA)
+		return -2;
+	*size = SERVE_REQUEST_SIZE + get_u16(buf + 6) + get_u32(buf + 8);
+
+	return (len >= *size ? 1 : 0);
+}
+
+
+/* Handle single (complete) request, response is appended to out */
+static int handle_request(struct serve_image *images, size_t count, const uint8_t *req,
+		struct serve_buf *out, bool *stop, int verbose)
+{
+	struct serve_image *img;
+	uint8_t resp[SERVE_RESPONSE_SIZE] = { 0 };
+	size_t path_len, data_len;
+	size_t start = out->len;
+	const uint8_t *data;
+	char *path;
+	int op, status;
+
+
+	op = req[4];
+	img = (req[5] < count ? &images[req[5]] : NULL);
+	path_len = get_u16(req + 6);
+	data_len = get_u32(req + 8);
+	data = req + SERVE_REQUEST_SIZE + path_len;
+
+	if (!(path = malloc(path_len + 1)))
+		return -1;
+	memcpy(path, req + SERVE_REQUEST_SIZE, path_len);
+	path[path_len] = 0;
+	if (buf_append(out, resp, sizeof(resp))) {
+		free(path);
+		return -2;
+	}
+	if (verbose > 1)
+		printf("%s: %s %s\n", (img ? img->filename : "?"),
+			op_names[op <= SERVE_OP_SHUTDOWN ? op : 0], path);
+
+	if (!img && op != SERVE_OP_SHUTDOWN) {
+		status = LFS_ERR_INVAL;
+	} else {
+		switch (op) {
+		case SERVE_OP_LIST:
+			status = op_list(&img->lfs, (*path ? path : "/"), out);
+			break;
+		case SERVE_OP_READ:
+			status = op_read(&img->lfs, path, out);
+			break;
+		case SERVE_OP_WRITE:
+			status = op_write(&img->lfs, path, data, data_len);
+			break;
+		case SERVE_OP_DELETE:
+			status = op_delete(&img->lfs, path);
+			break;
+		case SERVE_OP_FLUSH:
+			status = (flush_images(img, 1) ? LFS_ERR_IO : LFS_ERR_OK);
+			break;
+		case SERVE_OP_SHUTDOWN:
+			*stop = true;
+			status = LFS_ERR_OK;
+			break;
+		default:
+			status = LFS_ERR_INVAL;
+		}
+	}
+	if (status < 0)
+		out->len = start + SERVE_RESPONSE_SIZE;
+
+	put_u32(out->data + start, (uint32_t)status);
+	put_u32(out->data + start + 4, out->len - start - SERVE_RESPONSE_SIZE);
+	free(path);
+
+	return 0;
+}
+
+
+/* Send pending responses to client (without blocking) */
+static int client_write(struct serve_client *c)
+{
+	while (c->out_pos < c->out.len) {
+		ssize_t len = write(c->fd, c->out.data + c->out_pos, c->out.len - c->out_pos);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		c->out_pos += len;
+	}
+	c->out.len = c->out_pos = 0;
+	buf_trim(&c->out);
+
+	return 0;
+}
+
+
+/* Receive data from client (without blocking) and handle all complete
+   requests, returns non-zero if connection should be closed */
+static int client_read(struct serve_image *images, size_t count, struct serve_client *c,
+		bool *stop, int verbose)
+{
+	size_t pos = 0, size = 0;
+	ssize_t len;
+	int res;
+
+
+	if (buf_reserve(&c->in, SERVE_READ_SIZE))
+		return -1;
+	if ((len = read(c->fd, c->in.data + c->in.len, c->in.alloc - c->in.len)) == 0)
+		return -2;
+	if (len < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -3);
+	c->in.len += len;
+
+	while ((res = request_size(c->in.data + pos, c->in.len - pos, &size)) > 0) {
+		if (handle_request(images, count, c->in.data + pos, &c->out, stop, verbose))
+			return -4;
+		pos += size;
+		size = 0;
+	}
+	if (res < 0)
+		return -5;
+	if (pos > 0) {
+		memmove(c->in.data, c->in.data + pos, c->in.len - pos);
+		c->in.len -= pos;
+		buf_trim(&c->in);
+	}
+	/* Make room for rest of a large request in one go */
+	if (size > c->in.len && buf_reserve(&c->in, size - c->in.len))
+		return -6;
+
+	return client_write(c);
+}
+
+
+static void client_close(struct serve_client *c)
+{
+	close(c->fd);
+	free(c->in.data);
+	free(c->out.data);
+}
+
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+static int open_socket(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int sock;
+
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	/* Remove stale socket (left behind by previous server) */
+	if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(socket_path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -2;
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(sock, SERVE_MAX_CLIENTS)) {
+		close(sock);
+		return -3;
+	}
+
+	return sock;
+}
+
+
+int serve_images(const char *socket_path, char **files, size_t count,
+		uint8_t erase_value, int verbose)
+{
+	struct serve_image *images;
+	struct serve_client clients[SERVE_MAX_CLIENTS];
+	struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+	struct sigaction sa;
+	size_t nfds = 1;
+	bool stop = false;
+	int sock = -1;
+	int res = 0;
+
+
+	if (!socket_path || !files || count < 1 || count > SERVE_MAX_IMAGES)
+		return -1;
+	if (!(images = calloc(count, sizeof(struct serve_image))))
+		return -2;
+
+	for (size_t i = 0; i < count; i++) {
+		images[i].filename = files[i];
+		images[i].fd = -1;
+		if ((res = load_image(&images[i], erase_value))) {
+			warn("%s: failed to load image (%d)", files[i], res);
+			res = -3;
+			goto done;
+		}
+	}
+
+	if ((sock = open_socket(socket_path)) < 0) {
+		warn("%s: cannot listen on socket (%d)", socket_path, sock);
+		res = -4;
+		goto done;
+	}
+
+	/* Stop gracefully (writing back modified blocks) on SIGINT or SIGTERM */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (verbose) {
+		printf("Serving %zu image(s) on: %s\n", count, socket_path);
+		fflush(stdout);
+	}
+
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	while (!stop && !serve_stop) {
+		int n;
+
+		/* Clients are not read from while their responses are pending */
+		for (size_t i = 1; i < nfds; i++)
+			fds[i].events = (clients[i - 1].out.len > 0 ? POLLOUT : POLLIN);
+
+		n = poll(fds, nfds, SERVE_IDLE_FLUSH_MS);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			res = -5;
+			break;
+		}
+		if (n == 0) {
+			/* Idle, write modified blocks back to the image files */
+			flush_images(images, count);
+			continue;
+		}
+
+		for (size_t i = 1; i < nfds; i++) {
+			struct serve_client *c = &clients[i - 1];
+			short revents = fds[i].revents;
+			int err;
+
+			if (!revents)
+				continue;
+			if (revents & POLLOUT)
+				err = client_write(c);
+			else if (revents & POLLIN)
+				err = client_read(images, count, c, &stop, verbose);
+			else
+				err = -1;
+			if (err) {
+				client_close(c);
+				--nfds;
+				fds[i] = fds[nfds];
+				clients[i - 1] = clients[nfds - 1];
+				i--;
+			}
+		}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(sock, NULL, NULL);
+
+			if (fd < 0)
+				continue;
+			if (nfds >= SERVE_MAX_CLIENTS + 1) {
+				warn("too many clients");
+				close(fd);
+			} else if (set_nonblocking(fd)) {
+				warn("failed to set client socket non-blocking");
+				close(fd);
+			} else {
+				memset(&clients[nfds - 1], 0, sizeof(struct serve_client));
+				clients[nfds - 1].fd = fd;
+				fds[nfds].fd = fd;
+				fds[nfds++].revents = 0;
+			}
+		}
+	}
+
+	for (size_t i = 1; i < nfds; i++)
+		client_close(&clients[i - 1]);
+	close(sock);
+	unlink(socket_path);
+
+done:
+	for (size_t i = 0; i < count; i++) {
+		if (images[i].mounted && lfs_unmount(&images[i].lfs) != LFS_ERR_OK)
+			res = -6;
+	}
+	if (flush_images(images, count) && res == 0)
+		res = -7;
+	for (size_t i = 0; i < count; i++) {
+		lfs_destroy_context(images[i].ctx);
+		free(images[i].buf);
+		if (images[i].fd >= 0)
+			close(images[i].fd);
+	}
+	free(images);
+
+	return res;
+}
+
+#else
+
+int serve_images(const char *socket_path, char **files, size_t count,
+		uint8_t erase_value, int verbose)
+{
+	(void)socket_path;
+	(void)files;
+	(void)count;
+	(void)erase_value;
+	(void)verbose;
+
+	warn("Unix domain sockets not supported on this platform");
+
+	return -1;
+}
+
+#endif /* HAVE_SYS_UN_H */
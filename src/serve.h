@@ -0,0 +1,69 @@
+/* serve.h
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Protocol used over the Unix domain socket (all integers little-endian).
+ *
+ * Request:  magic (u32), op (u8), image index (u8), path length (u16),
+ *           data length (u32), path, data
+ * Response: status (i32, 0 or negative LittleFS error code), data length (u32),
+ *           data
+ *
+ * SERVE_OP_LIST returns entries of directory: type (u8), size (u32),
+ * name length (u16), name.
+ */
+
+#define SERVE_MAGIC         0x5653464c /* "LFSV" */
+#define SERVE_REQUEST_SIZE  12
+#define SERVE_RESPONSE_SIZE 8
+
+#define SERVE_OP_LIST     1
+#define SERVE_OP_READ     2
+#define SERVE_OP_WRITE    3
+#define SERVE_OP_DELETE   4
+#define SERVE_OP_FLUSH    5
+#define SERVE_OP_SHUTDOWN 6
+
+#define SERVE_TYPE_FILE 1
+#define SERVE_TYPE_DIR  2
+
+
+int serve_images(const char *socket_path, char **images, size_t count,
+		uint8_t erase_value, int verbose);
+
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _SERVE_H_ */
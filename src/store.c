@@ -0,0 +1,468 @@
+/* store.c
+   Copyright (C) 2026 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of LittleFS-Toy.
+
+   LittleFS-Toy is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   LittleFS-Toy is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Content-addressed block store for images.
+ *
+ * Store directory layout:
+ *
+ *   <dir>/blocks/<xx>/<hash>   block contents (named by hash of the block)
+ *   <dir>/images/<name>        image manifest
+ *
+ * Image manifest format (all values are little-endian):
+ *
+ *   header:
+ *     uint32_t magic;          "LFSM"
+ *     uint16_t version;        1
+ *     uint16_t header_size;    16
+ *     uint32_t block_size;
+ *     uint32_t block_count;
+ *
+ *   uint8_t hash[block_count][16];
+ *
+ *   uint32_t crc;              CRC-32 (as used by littlefs) of all preceding bytes
+ *
+ * Blocks are identified by a (non-cryptographic) 128-bit hash.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef __MINGW32__
+#include "win32_compat.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <lfs.h>
+#include <lfs_util.h>
+
+#include "littlefs-toy.h"
+
+#define STORE_MAGIC 0x4d53464c /* "LFSM" */
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 16
+#define STORE_HASH_SIZE 16
+#define STORE_MAX_THREADS 8
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+
+
+struct hash_job {
+	const uint8_t *image;
+	size_t block_size;
+	size_t first;
+	size_t count;
+	uint8_t *hashes;
+};
+
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t avalanche64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+
+static inline uint64_t get_u64(const uint8_t *p)
+{
+	uint64_t val = 0;
+
+	for (int i = 7; i >= 0; i--)
+		val = (val << 8) | p[i];
+
+	return val;
+}
+
+
+/* Hash a block into 128-bit value. Block is processed in 32 byte stripes,
+   using four independent lanes so that the compiler can vectorize the
+   main loop. Lanes are loaded as little-endian, so that hashes (and
+   block names in the store) are the same on all hosts. */
+static void block_hash(const uint8_t *data, size_t len, uint8_t *out)
+{
+	uint64_t v[4] = { PRIME64_1 + PRIME64_2, PRIME64_2, 0, -PRIME64_1 };
+	uint8_t tail[32];
+	uint64_t h1, h2;
+	size_t pos = 0;
+
+
+	for (; pos + 32 <= len; pos += 32) {
+		for (int i = 0; i < 4; i++) {
+			v[i] += get_u64(data + pos + i * 8) * PRIME64_2;
+			v[i] = rotl64(v[i], 31);
+			v[i] *= PRIME64_1;
+		}
+	}
+	if (pos < len) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, data + pos, len - pos);
+		for (int i = 0; i < 4; i++) {
+			v[i] += get_u64(tail + i * 8) * PRIME64_2;
+			v[i] = rotl64(v[i], 31);
+			v[i] *= PRIME64_1;
+		}
+	}
+
+	h1 = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+	h2 = rotl64(v[0], 29) ^ rotl64(v[1], 41) ^ rotl64(v[2], 47) ^ rotl64(v[3], 53);
+	h1 = avalanche64(h1 ^ len);
+	h2 = avalanche64(h2 + h1 * PRIME64_3);
+
+	for (int i = 0; i < 8; i++) {
+		out[i] = (h1 >> (i * 8)) & 0xff;
+		out[i + 8] = (h2 >> (i * 8)) & 0xff;
+	}
+}
+
+
+static void* hash_thread(void *arg)
+{
+	struct hash_job *job = (struct hash_job*)arg;
+
+	for (size_t i = job->first; i < job->first + job->count; i++)
+		block_hash(job->image + i * job->block_size, job->block_size,
+			job->hashes + i * STORE_HASH_SIZE);
+
+	return NULL;
+}
+
+
+/* Calculate hashes of all blocks in the image (in parallel) */
+static int hash_blocks(const void *image, size_t block_size, size_t block_count,
+		uint8_t *hashes)
+{
+	struct hash_job jobs[STORE_MAX_THREADS];
+	pthread_t threads[STORE_MAX_THREADS];
+	int thread_count = 2;
+	int started = 0;
+	size_t first = 0;
+
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((thread_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		thread_count = 1;
+	if (thread_count > STORE_MAX_THREADS)
+		thread_count = STORE_MAX_THREADS;
+#endif
+	if ((size_t)thread_count > block_count)
+		thread_count = (block_count > 0 ? block_count : 1);
+
+	for (int i = 0; i < thread_count; i++) {
+		size_t count = block_count / thread_count
+			+ ((size_t)i < block_count % thread_count ? 1 : 0);
+
+		jobs[i].image = image;
+		jobs[i].block_size = block_size;
+		jobs[i].first = first;
+		jobs[i].count = count;
+		jobs[i].hashes = hashes;
+		first += count;
+
+		/* Hash in this thread, if thread cannot be created */
+		if (pthread_create(&threads[i], NULL, hash_thread, &jobs[i]))
+			hash_thread(&jobs[i]);
+		else
+			started |= (1 << i);
+	}
+	for (int i = 0; i < thread_count; i++) {
+		if (started & (1 << i))
+			pthread_join(threads[i], NULL);
+	}
+
+	return 0;
+}
+
+
+static void block_path(char *buf, size_t size, const char *store_dir, const uint8_t *hash)
+{
+	char hex[STORE_HASH_SIZE * 2 + 1];
+
+	for (int i = 0; i < STORE_HASH_SIZE; i++)
+		snprintf(hex + i * 2, 3, "%02x", hash[i]);
+	snprintf(buf, size, "%s/blocks/%c%c/%s", store_dir, hex[0], hex[1], hex);
+}
+
+
+static int valid_name(const char *name)
+{
+	if (!name || *name == 0 || *name == '.' || strchr(name, '/'))
+		return 0;
+	return 1;
+}
+
+
+static int write_new_file(const char *pathname, void *data, size_t len)
+{
+	char tmpname[PATH_MAX + 1];
+	int fd, res = 0;
+
+	/* Write into temporary file first, so that store never contains partial files */
+	snprintf(tmpname, sizeof(tmpname), "%s.%ld.tmp", pathname, (long)getpid());
+	if ((fd = create_file(tmpname, 0)) < 0)
+		return -1;
+	if (write_file(fd, 0, data, len))
+		res = -2;
+	close(fd);
+	if (res == 0 && rename(tmpname, pathname))
+		res = -3;
+	if (res)
+		unlink(tmpname);
+
+	return res;
+}
+
+
+/* Check that block already in the store has the same contents
+   (returns 1 if identical, 0 if different, and negative value on error) */
+static int same_block(const char *pathname, const void *data, size_t len, void *buf)
+{
+	int fd, res;
+
+	if ((fd = open_file(pathname, true)) < 0)
+		return -1;
+	if (file_size(fd) != (off_t)len)
+		res = 0;
+	else if (read_file(fd, 0, buf, len))
+		res = -2;
+	else
+		res = (memcmp(buf, data, len) == 0 ? 1 : 0);
+	close(fd);
+
+	return res;
+}
+
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+int store_image(const char *store_dir, const char *name, const void *image,
+		size_t block_size, size_t block_count, bool verbose)
+{
+	char pathname[PATH_MAX + 1];
+	uint8_t *manifest, *hashes, *buf;
+	size_t manifest_size, new_blocks = 0;
+	int res = 0;
+
+
+	if (!store_dir || !image || block_size < 1)
+		return -1;
+	if (!valid_name(name)) {
+		warn("invalid image name: %s", (name ? name : "(null)"));
+		return -2;
+	}
+
+	manifest_size = STORE_HEADER_SIZE + block_count * STORE_HASH_SIZE + 4;
+	if (!(manifest = calloc(1, manifest_size)))
+		return -3;
+	if (!(buf = malloc(block_size))) {
+		free(manifest);
+		return -3;
+	}
+	hashes = manifest + STORE_HEADER_SIZE;
+
+	hash_blocks(image, block_size, block_count, hashes);
+
+	/* Write blocks that are not yet in the store */
+	for (size_t i = 0; i < block_count && res == 0; i++) {
+		block_path(pathname, sizeof(pathname), store_dir, hashes + i * STORE_HASH_SIZE);
+		if (file_exists(pathname)) {
+			/* Hash is not cryptographic, so only reuse block with same contents */
+			int same = same_block(pathname, (uint8_t*)image + i * block_size,
+					block_size, buf);
+
+			if (same == 1)
+				continue;
+			if (same < 0)
+				warn("%s: failed to read block", pathname);
+			else
+				warn("%s: hash collision with block %zu", pathname, i);
+			res = -8;
+			break;
+		}
+		*strrchr(pathname, '/') = 0;
+		if (mkdir_parent(pathname, 0755)) {
+			warn("%s: cannot create directory", pathname);
+			res = -4;
+			break;
+		}
+		block_path(pathname, sizeof(pathname), store_dir, hashes + i * STORE_HASH_SIZE);
+		if (write_new_file(pathname, (uint8_t*)image + i * block_size, block_size)) {
+			warn("%s: failed to write block", pathname);
+			res = -5;
+			break;
+		}
+		new_blocks++;
+	}
+
+	/* Write image manifest */
+	if (res == 0) {
+		put_u32(manifest, STORE_MAGIC);
+		manifest[4] = STORE_VERSION;
+		manifest[6] = STORE_HEADER_SIZE;
+		put_u32(manifest + 8, block_size);
+		put_u32(manifest + 12, block_count);
+		put_u32(manifest + manifest_size - 4,
+			lfs_crc(0xffffffff, manifest, manifest_size - 4));
+
+		snprintf(pathname, sizeof(pathname), "%s/images", store_dir);
+		if (mkdir_parent(pathname, 0755)) {
+			warn("%s: cannot create directory", pathname);
+			res = -6;
+		} else {
+			snprintf(pathname, sizeof(pathname), "%s/images/%s", store_dir, name);
+			if (write_new_file(pathname, manifest, manifest_size)) {
+				warn("%s: failed to write image manifest", pathname);
+				res = -7;
+			}
+		}
+	}
+
+	if (res == 0 && verbose)
+		printf("%s: %zu blocks (%zu new, %zu already in store)\n", name, block_count,
+			new_blocks, block_count - new_blocks);
+
+	free(buf);
+	free(manifest);
+
+	return res;
+}
+
+
+int materialize_image(const char *store_dir, const char *name, int fd, off_t offset,
+		bool verbose)
+{
+	char pathname[PATH_MAX + 1];
+	uint8_t *manifest = NULL, *block = NULL;
+	uint8_t hash[STORE_HASH_SIZE];
+	uint32_t block_size = 0, block_count = 0;
+	off_t manifest_size = 0;
+	int mfd, bfd;
+	int res = 0;
+
+
+	if (!store_dir || fd < 0)
+		return -1;
+	if (!valid_name(name)) {
+		warn("invalid image name: %s", (name ? name : "(null)"));
+		return -2;
+	}
+
+	/* Read and validate image manifest */
+	snprintf(pathname, sizeof(pathname), "%s/images/%s", store_dir, name);
+	if ((mfd = open_file(pathname, true)) < 0) {
+		warn("%s: image not found in store", name);
+		return -3;
+	}
+	if ((manifest_size = file_size(mfd)) < STORE_HEADER_SIZE + 4)
+		res = -4;
+	else if (!(manifest = malloc(manifest_size)))
+		res = -5;
+	else if (read_file(mfd, 0, manifest, manifest_size))
+		res = -6;
+	close(mfd);
+
+	if (res == 0) {
+		block_size = get_u32(manifest + 8);
+		block_count = get_u32(manifest + 12);
+		if (get_u32(manifest) != STORE_MAGIC || manifest[4] != STORE_VERSION
+			|| manifest[6] != STORE_HEADER_SIZE || block_size < 1
+			|| (uint64_t)manifest_size != STORE_HEADER_SIZE
+			+ (uint64_t)block_count * STORE_HASH_SIZE + 4
+			|| lfs_crc(0xffffffff, manifest, manifest_size - 4)
+			!= get_u32(manifest + manifest_size - 4))
+			res = -7;
+	}
+	if (res) {
+		warn("%s: invalid image manifest", pathname);
+		free(manifest);
+		return res;
+	}
+
+	if (!(block = malloc(block_size)))
+		res = -8;
+
+	/* Reconstruct image from the blocks */
+	for (uint32_t i = 0; i < block_count && res == 0; i++) {
+		const uint8_t *h = manifest + STORE_HEADER_SIZE + i * STORE_HASH_SIZE;
+
+		block_path(pathname, sizeof(pathname), store_dir, h);
+		if ((bfd = open_file(pathname, true)) < 0) {
+			warn("%s: block missing from store", pathname);
+			res = -9;
+			break;
+		}
+		if (file_size(bfd) != (off_t)block_size || read_file(bfd, 0, block, block_size))
+			res = -10;
+		close(bfd);
+		if (res == 0) {
+			block_hash(block, block_size, hash);
+			if (memcmp(hash, h, STORE_HASH_SIZE))
+				res = -10;
+		}
+		if (res) {
+			warn("%s: corrupted block in store", pathname);
+			break;
+		}
+		if (write_file(fd, offset + (off_t)i * block_size, block, block_size)) {
+			warn("failed to write image (%d)", errno);
+			res = -11;
+		}
+	}
+
+	if (res == 0 && verbose)
+		printf("%s: %u blocks (%llu bytes)\n", name, block_count,
+			(unsigned long long)block_count * block_size);
+
+	free(block);
+	free(manifest);
+
+	return res;
+}
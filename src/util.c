@@ -21,6 +21,7 @@
  * along with LittleFS-Toy. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* for fallocate() */
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -41,51 +42,110 @@
 #include <wctype.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "littlefs-toy.h"
 
 #define BUF_SIZE (64 * 1024)
+#define STREAM_BUF_SIZE (1024 * 1024)
 
 
 
+/* Check if buffer contains only given byte value. Comparing buffer against itself
+   (shifted by one byte) lets memcmp() do the work using vector instructions. */
+bool is_blank_buf(const void *buf, size_t size, uint8_t value)
+{
+	const uint8_t *p = buf;
+
+	if (size < 1)
+		return true;
+	if (p[0] != value)
+		return false;
+	return (memcmp(p, p + 1, size - 1) == 0);
+}
+
+
+static int fill_file(int fd, off_t offset, off_t size, uint8_t value)
+{
+	off_t written = 0;
+	off_t curr_pos;
+	void *buf;
+
+	if ((curr_pos = lseek(fd, 0, SEEK_CUR)) < 0)
+		return -2;
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -3;
+	if (!(buf = malloc(BUF_SIZE)))
+		return -4;
+	memset(buf, value, BUF_SIZE);
+
+	while (written < size) {
+		ssize_t len = ((size - written) > BUF_SIZE ? BUF_SIZE : (size - written));
+		ssize_t wrote;
+
+		do {
+			wrote = write(fd, buf, len);
+		} while (wrote < 0 && errno == EINTR);
+		if (wrote <= 0)
+			break;
+		written += len;
+	}
+	free(buf);
+
+	if (written < size)
+		return -5;
+
+	if (lseek(fd, curr_pos, SEEK_SET) < 0)
+		return -6;
+
+	return 0;
+}
+
+
 int file_set_zero(int fd, off_t offset, off_t size)
 {
+	off_t fsize;
+
 	if (fd < 0)
 		return -1;
+	if (size < 1)
+		return 0;
 
-	if (size > 0) {
-		off_t written = 0;
-		off_t curr_pos;
-		void *buf;
+	/* Extend file (sparse) when zeroed range is past the end of file */
+	if ((fsize = file_size(fd)) >= 0 && offset + size > fsize
+		&& ftruncate(fd, offset + size) == 0) {
+		if (offset >= fsize)
+			return 0;
+		size = fsize - offset;
+	}
 
-		if ((curr_pos = lseek(fd, 0, SEEK_CUR)) < 0)
-			return -2;
-		if (lseek(fd, offset, SEEK_SET) < 0)
-			return -3;
-		if (!(buf = calloc(1, BUF_SIZE)))
-			return -4;
+#ifdef HAVE_FALLOCATE
+	/* Deallocate range (or let filesystem zero it) without writing zeros */
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0)
+		return 0;
+#endif
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, size) == 0)
+		return 0;
+#endif
+#endif
 
-		while (written < size) {
-			ssize_t len = ((size - written) > BUF_SIZE ? BUF_SIZE : (size - written));
-			ssize_t wrote;
+	return fill_file(fd, offset, size, 0);
+}
 
-			do {
-				wrote = write(fd, buf, len);
-			} while (wrote < 0 && errno == EINTR);
-			if (wrote <= 0)
-				break;
-			written += len;
-		}
-		free(buf);
 
-		if (written < size)
-			return -5;
+int file_set_value(int fd, off_t offset, off_t size, uint8_t value)
+{
+	if (value == 0)
+		return file_set_zero(fd, offset, size);
 
-		if (lseek(fd, curr_pos, SEEK_SET) < 0)
-			return -6;
-	}
+	if (fd < 0)
+		return -1;
+	if (size < 1)
+		return 0;
 
-	return 0;
+	return fill_file(fd, offset, size, value);
 }
 
 
@@ -129,6 +189,48 @@ int open_file(const char *name, bool readonly)
 }
 
 
+/* Read (non-seekable) stream until end of file into a buffer */
+int read_stream(int fd, void **buf, size_t *size)
+{
+	size_t alloc = STREAM_BUF_SIZE;
+	size_t pos = 0;
+	uint8_t *p, *tmp;
+	ssize_t len;
+
+
+	if (!buf || !size)
+		return -1;
+	if (!(p = malloc(alloc)))
+		return -2;
+
+	while (1) {
+		if (pos == alloc) {
+			if (!(tmp = realloc(p, alloc * 2))) {
+				free(p);
+				return -2;
+			}
+			p = tmp;
+			alloc *= 2;
+		}
+		do {
+			len = read(fd, p + pos, alloc - pos);
+		} while (len < 0 && errno == EINTR);
+		if (len < 0) {
+			free(p);
+			return -3;
+		}
+		if (len == 0)
+			break;
+		pos += len;
+	}
+
+	*buf = p;
+	*size = pos;
+
+	return 0;
+}
+
+
 int read_file(int fd, off_t offset, void *buf, size_t size)
 {
 	size_t bytes_read = 0;
@@ -152,6 +254,42 @@ int read_file(int fd, off_t offset, void *buf, size_t size)
 }
 
 
+/* Write buffer to a file, blocks that contain only zeros are zeroed using
+   file_set_zero() instead, so they don't allocate space in the file. */
+int write_file_sparse(int fd, off_t offset, void *buf, size_t size, size_t block_size)
+{
+	size_t pos = 0;
+	int res;
+
+	if (fd < 0 || offset < 0 || block_size < 1)
+		return -1;
+
+	while (pos < size) {
+		size_t len = (size - pos > block_size ? block_size : size - pos);
+		bool zero = is_blank_buf(buf + pos, len, 0);
+		size_t start = pos;
+
+		/* Find run of blocks of same type */
+		pos += len;
+		while (pos < size) {
+			len = (size - pos > block_size ? block_size : size - pos);
+			if (is_blank_buf(buf + pos, len, 0) != zero)
+				break;
+			pos += len;
+		}
+
+		if (zero)
+			res = file_set_zero(fd, offset + start, pos - start);
+		else
+			res = write_file(fd, offset + start, buf + start, pos - start);
+		if (res)
+			return res;
+	}
+
+	return 0;
+}
+
+
 int write_file(int fd, off_t offset, void *buf, size_t size)
 {
 	size_t bytes_written = 0;
@@ -282,6 +420,34 @@ char *trim_str(char *s)
 }
 
 
+/* Return (newly allocated) absolute path of a file, so that the file can be
+   accessed after changing the current directory */
+char *absolute_path(const char *path)
+{
+	char cwd[PATH_MAX + 1];
+	char *buf;
+	size_t len;
+
+	if (!path)
+		return NULL;
+#ifdef WIN32
+	if (path[0] == '/' || path[0] == '\\' || (path[0] && path[1] == ':'))
+		return strdup(path);
+#else
+	if (path[0] == '/')
+		return strdup(path);
+#endif
+	if (!getcwd(cwd, sizeof(cwd)))
+		return NULL;
+
+	len = strlen(cwd) + strlen(path) + 2;
+	if (!(buf = malloc(len)))
+		return NULL;
+	snprintf(buf, len, "%s/%s", cwd, path);
+
+	return buf;
+}
+
 char *splitdir(const char *filename)
 {
 	char *buf = NULL;
@@ -303,6 +469,39 @@ char *splitdir(const char *filename)
 	return buf;
 }
 
+int match_pattern(const char *pattern, const char *str)
+{
+	const char *star = NULL;
+	const char *mark = NULL;
+
+	if (!pattern || !str)
+		return 0;
+
+	/* Simple wildcard match: '*' matches any string, '?' matches any character */
+	while (*str) {
+		if (*pattern == '*') {
+			star = pattern++;
+			mark = str;
+		}
+		else if (*pattern == '?' || *pattern == *str) {
+			pattern++;
+			str++;
+		}
+		else if (star) {
+			pattern = star + 1;
+			str = ++mark;
+		}
+		else {
+			return 0;
+		}
+	}
+	while (*pattern == '*')
+		pattern++;
+
+	return (*pattern == 0 ? 1 : 0);
+}
+
+
 int parse_int_str(const char *str, int64_t *val, int64_t min, int64_t max)
 {
 	char *str_copy = NULL;
@@ -405,41 +604,16 @@ void fatal(const char *format, ...)
 }
 
 
-static bool warn_enabled = true;
-static char last_warn[1024] = { 0 };
-
 void warn(const char *format, ...)
 {
 	va_list args;
 
-	if (warn_enabled) {
-		fprintf(stderr, PROGRAMNAME ": ");
-	}
-
+	fprintf(stderr, PROGRAMNAME ": ");
 	va_start(args,format);
-	vsnprintf(last_warn, sizeof(last_warn), format, args);
-	last_warn[sizeof(last_warn) - 1] = 0;
+	vfprintf(stderr, format, args);
 	va_end(args);
-
-	if (warn_enabled) {
-		fprintf(stderr,"%s\n", last_warn);
-		fflush(stderr);
-	}
-}
-
-const char* warn_last_msg()
-{
-	return last_warn;
-}
-
-void warn_clear_last_msg()
-{
-	last_warn[0] = 0;
-}
-
-void warn_mode(bool enable)
-{
-	warn_enabled = enable;
+	fprintf(stderr,"\n");
+	fflush(stderr);
 }
 
 /* eof :-) */
@@ -21,7 +21,14 @@
 """littlefs-toy unit tester"""
 
 import os
+import re
+import struct
+import zlib
 import subprocess
+import socket
+import time
+import tarfile
+import gzip
 import io
 import shutil
 import hashlib
@@ -119,6 +126,24 @@ class LFSTests(unittest.TestCase):
                 #print(f'Checking {fname}: {h_orig} vs {h_new}')
                 self.assertEqual(h_orig, h_new)
 
+    def test_extract_skip_unchanged(self):
+        """test extracting files only if they have changed"""
+        testfiles = self.testfiles
+        output, res = self.run_test(['-xvf','lfs_4096.img'], directory=True)
+        # modify one of the extracted files
+        changed = testfiles[1]
+        with open(self.workdir + '/' + changed, 'r+b') as f:
+            f.write(b'\0\0\0\0')
+        output2, res2 = self.run_test(['-xvf','lfs_4096.img','--skip-unchanged'],
+                                      directory=True)
+        for fname in testfiles:
+            if fname == changed:
+                self.assertRegex(output2, r'\./' + fname + '\n')
+            else:
+                self.assertRegex(output2, r'\./' + fname + r' \(unchanged\)\n')
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
     def test_create(self):
         """test creating image from files"""
         testfiles = self.testfiles
@@ -135,6 +160,694 @@ class LFSTests(unittest.TestCase):
             #print(f'Checking {fname}: {h_orig} vs {h_new}')
             self.assertEqual(h_orig, h_new)
 
+    def test_create_sparse(self):
+        """test that new image file only allocates space for the content"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-cf', image, '-s', '256M'] + testfiles)
+        st = os.stat(image)
+        self.assertEqual(256 * 1024 * 1024, st.st_size)
+        if hasattr(st, 'st_blocks'):
+            self.assertLess(st.st_blocks * 512, 16 * 1024 * 1024)
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_erase_value(self):
+        """test creating image with 0xff erase value and blank region map"""
+        testfiles = self.testfiles
+        for mode in ([], ['--direct']):
+            image = self.tmpdir + '/lfs.img'
+            blank_map = self.tmpdir + '/blank.txt'
+            output, res = self.run_test(['-cf', image, '-O', '-s', '1M', '--erase-value',
+                                         '0xff', '--blank-map', blank_map]
+                                        + mode + testfiles)
+            with open(image, 'rb') as f:
+                data = f.read()
+            self.assertEqual(b'\xff' * 4096, data[-4096:])
+            blank = 0
+            with open(blank_map, 'r') as f:
+                for line in f:
+                    if line.startswith('#'):
+                        continue
+                    offset, size = [int(x, 16) for x in line.split()]
+                    self.assertEqual(b'\xff' * size, data[offset:offset + size])
+                    blank += size
+            self.assertGreater(blank, 900 * 1024)
+            output2, res2 = self.run_test(['-xvf', image, '--erase-value', '0xff'],
+                                          directory=True)
+            for fname in testfiles:
+                self.assertEqual(self.get_hash(fname, tmpdir=False),
+                                 self.get_hash(fname, tmpdir=True))
+
+    def test_export_uf2(self):
+        """test exporting image as UF2 and Intel HEX"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        uf2 = self.tmpdir + '/lfs.uf2'
+        ihex = self.tmpdir + '/lfs.hex'
+        base = 0x10100000
+        size = 1024 * 1024
+        output, res = self.run_test(['-cf', image, '-s', '1M', '--erase-value', '0xff',
+                                     '--uf2', uf2, '--ihex', ihex,
+                                     '--base-address', hex(base)] + testfiles)
+        # reconstruct image as it would be in (erased) flash
+        flash = bytearray(b'\xff' * size)
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        self.assertEqual(0, len(data) % 512)
+        self.assertLess(len(data) // 512, 64)
+        for i in range(0, len(data), 512):
+            (magic0, magic1, flags, addr, length, blockno, total,
+             family) = struct.unpack('<8I', data[i:i + 32])
+            self.assertEqual((0x0a324655, 0x9e5d5157), (magic0, magic1))
+            self.assertEqual((i // 512, len(data) // 512), (blockno, total))
+            self.assertEqual(0xe48bff56, family)
+            flash[addr - base:addr - base + length] = data[i + 32:i + 32 + length]
+        flash2 = bytearray(b'\xff' * size)
+        upper = 0
+        with open(ihex, 'r') as f:
+            for line in f:
+                rec = bytes.fromhex(line.strip()[1:])
+                self.assertEqual(0, sum(rec) & 0xff)
+                if rec[3] == 4:
+                    upper = ((rec[4] << 8) | rec[5]) << 16
+                elif rec[3] == 0:
+                    addr = upper + ((rec[1] << 8) | rec[2]) - base
+                    flash2[addr:addr + rec[0]] = rec[4:4 + rec[0]]
+        self.assertEqual(flash, flash2)
+        with open(image, 'wb') as f:
+            f.write(flash)
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_export_zero_pages(self):
+        """test that zero-filled pages are exported with default erase value"""
+        image = self.tmpdir + '/lfs.img'
+        uf2 = self.tmpdir + '/lfs.uf2'
+        zeros = self.tmpdir + '/zeros.bin'
+        with open(zeros, 'wb') as f:
+            f.write(b'\x01' * 256 + bytes(8192) + b'\x02' * 256)
+        output, res = self.run_test(['-cf', image, '-s', '256K', '--uf2', uf2,
+                                     '-C', self.tmpdir, 'zeros.bin'])
+        # flash erases to 0xff, so all pages must be present in the UF2 file
+        flash = bytearray(b'\xff' * 256 * 1024)
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        for i in range(0, len(data), 512):
+            addr, length = struct.unpack('<2I', data[i + 12:i + 20])
+            flash[addr:addr + length] = data[i + 32:i + 32 + length]
+        with open(image, 'wb') as f:
+            f.write(flash)
+        self.workdir = self.tmpdir + '/test_export_zero_pages'
+        os.makedirs(self.workdir)
+        output, res = self.run_test(['-xf', image, '-C', self.workdir])
+        with open(self.workdir + '/zeros.bin', 'rb') as f1, open(zeros, 'rb') as f2:
+            self.assertEqual(f2.read(), f1.read())
+
+    def test_firmware_container(self):
+        """test updating filesystem inside an UF2 file"""
+        testfiles = self.testfiles
+        uf2 = self.tmpdir + '/lfs.uf2'
+        base = 0x10100000
+        output, res = self.run_test(['-cf', self.tmpdir + '/lfs.img', '-s', '1M',
+                                     '--uf2', uf2, '--base-address', hex(base)]
+                                    + testfiles[:-1])
+        # add (fake) firmware in front of the filesystem
+        firmware = struct.pack('<8I', 0x0a324655, 0x9e5d5157, 0x2000, base - 0x1000,
+                               256, 0, 0, 0xe48bff56) + b'firmware' * 32
+        firmware += bytes(508 - len(firmware)) + struct.pack('<I', 0x0ab16f30)
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        with open(uf2, 'wb') as f:
+            f.write(firmware + data)
+        output, res = self.run_test(['-rf', uf2, '-o', hex(base), testfiles[-1]])
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        self.assertEqual(firmware[32:32 + 256], data[32:32 + 256])
+        output2, res2 = self.run_test(['-xvf', uf2, '-o', hex(base)], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_firmware_container_blocks(self):
+        """test that UF2 blocks outside the filesystem are kept as is"""
+        testfiles = self.testfiles
+        uf2 = self.tmpdir + '/lfs.uf2'
+        base = 0x10100000
+        output, res = self.run_test(['-cf', self.tmpdir + '/lfs.img', '-s', '256K',
+                                     '--uf2', uf2, '--base-address', hex(base)]
+                                    + testfiles[:1])
+
+        def uf2_block(flags, addr, payload, family):
+            blk = struct.pack('<8I', 0x0a324655, 0x9e5d5157, flags, addr,
+                              len(payload), 0, 0, family) + payload
+            return blk + bytes(508 - len(blk)) + struct.pack('<I', 0x0ab16f30)
+
+        # firmware with a different family, and a block not meant for main flash
+        extra = [uf2_block(0x2000, base - 0x1000, b'firmware' * 32, 0x12345678),
+                 uf2_block(0x2001, 0x20000000, b'comment' * 8, 0xe48bff56)]
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        with open(uf2, 'wb') as f:
+            f.write(b''.join(extra) + data)
+        # relative image path must still refer to the same file after -C
+        self.workdir = self.tmpdir + '/files'
+        os.makedirs(self.workdir)
+        shutil.copy(testfiles[-1], self.workdir)
+        output, res = self.run_test(['-rf', os.path.relpath(uf2), '-o', hex(base),
+                                     '-C', self.workdir, testfiles[-1]])
+        with open(uf2, 'rb') as f:
+            data = f.read()
+        blocks = [data[i:i + 512] for i in range(0, len(data), 512)]
+        for i, blk in enumerate(blocks):
+            self.assertEqual((i, len(blocks)), struct.unpack('<2I', blk[20:28]))
+        kept = [blk[:20] + blk[28:] for blk in blocks]
+        for blk in extra:
+            self.assertIn(blk[:20] + blk[28:], kept)
+        self.workdir = None
+        output2, res2 = self.run_test(['-xvf', uf2, '-o', hex(base)], directory=True)
+        for fname in [testfiles[0], testfiles[-1]]:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_firmware_container_ihex(self):
+        """test that Intel HEX start address is kept when updating filesystem"""
+        testfiles = self.testfiles
+        ihex = self.tmpdir + '/lfs.hex'
+        base = 0x10100000
+        output, res = self.run_test(['-cf', self.tmpdir + '/lfs.img', '-s', '256K',
+                                     '--ihex', ihex, '--base-address', hex(base)]
+                                    + testfiles[:1])
+        start = ':0400000510000101E5\n'
+        with open(ihex, 'r') as f:
+            lines = f.readlines()
+        self.assertEqual(':00000001FF\n', lines[-1])
+        with open(ihex, 'w') as f:
+            f.write(''.join(lines[:-1]) + start + lines[-1])
+        output, res = self.run_test(['-rf', ihex, '-o', hex(base), testfiles[-1]])
+        with open(ihex, 'r') as f:
+            lines = f.readlines()
+        self.assertEqual([start, ':00000001FF\n'], lines[-2:])
+        output2, res2 = self.run_test(['-xvf', ihex, '-o', hex(base)], directory=True)
+        for fname in [testfiles[0], testfiles[-1]]:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_from_tar(self):
+        """test adding files from a tar file"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        tarball = self.tmpdir + '/files.tar'
+        with tarfile.open(tarball, 'w', format=tarfile.PAX_FORMAT) as tar:
+            for fname in testfiles:
+                tar.add(fname, arcname='./data/' + fname)
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '--from-tar', tarball])
+        for fname in testfiles:
+            self.assertIn('data/' + fname, output)
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash('data/' + fname, tmpdir=True))
+
+    def test_from_tar_auto_size(self):
+        """test adding deeply nested files from a tar file with -s auto"""
+        image = self.tmpdir + '/lfs.img'
+        tarball = self.tmpdir + '/files.tar'
+        nested = '/'.join('d%d' % i for i in range(12))
+        longname = 'long/' + 'x' * 120 + '/file.txt'
+
+        def header(name, type, size):
+            info = tarfile.TarInfo(name)
+            info.type = type
+            info.size = size
+            return info.tobuf(format=tarfile.GNU_FORMAT)
+
+        with open(self.testfiles[0], 'rb') as f:
+            data = f.read()
+        with open(tarball, 'wb') as f:
+            f.write(header(nested, tarfile.DIRTYPE, 0))
+            f.write(header(nested + '/' + self.testfiles[0], tarfile.REGTYPE, len(data)))
+            f.write(data + bytes(-len(data) % 512))
+            # pax size must only apply to the regular file, not to the long name header
+            rec = b'10 size=5\n'
+            f.write(header('PaxHeader', tarfile.XHDTYPE, len(rec)))
+            f.write(rec + bytes(512 - len(rec)))
+            name = longname.encode() + b'\0'
+            f.write(header('././@LongLink', tarfile.GNUTYPE_LONGNAME, len(name)))
+            f.write(name + bytes(-len(name) % 512))
+            f.write(header('file.txt', tarfile.REGTYPE, 0))
+            f.write(b'hello' + bytes(507))
+            f.write(bytes(1024))
+        output, res = self.run_test(['-cf', image, '-s', 'auto', '--from-tar', tarball])
+        output, res = self.run_test(['-xf', image], directory=True)
+        self.assertEqual(self.get_hash(self.testfiles[0]),
+                         self.get_hash(nested + '/' + self.testfiles[0], tmpdir=True))
+        with open(self.workdir + '/' + longname, 'rb') as f:
+            self.assertEqual(b'hello', f.read())
+
+    def test_to_tar(self):
+        """test extracting files as a tar stream"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-cf', image, '-s', '1M'] + testfiles)
+        res = subprocess.run([self.program, '-xvf', image, '--to-tar=-'],
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+        self.assertEqual(0, len(res.stdout) % 512)
+        with tarfile.open(fileobj=io.BytesIO(res.stdout), mode='r:') as tar:
+            names = tar.getnames()
+            for fname in testfiles:
+                self.assertIn(fname, names)
+                self.assertIn(fname, res.stderr.decode())
+                with open(fname, 'rb') as f:
+                    self.assertEqual(f.read(), tar.extractfile(fname).read())
+
+    def test_to_tar_long_path(self):
+        """test extracting files with long paths as a tar stream"""
+        image = self.tmpdir + '/lfs.img'
+        tarball = self.tmpdir + '/files.tar'
+        longname = '/'.join(['directory%02d' % i for i in range(25)]) + '/file.bin'
+        self.assertGreater(len(longname), 255)
+        with open(self.testfiles[0], 'rb') as f:
+            data = f.read()
+        with tarfile.open(tarball, 'w', format=tarfile.PAX_FORMAT) as tar:
+            info = tarfile.TarInfo(longname)
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+        output, res = self.run_test(['-cf', image, '-s', '1M', '--from-tar', tarball])
+        output, res = self.run_test(['-tf', image])
+        self.assertIn('./' + longname + '\n', output)
+        res = subprocess.run([self.program, '-xf', image, '--to-tar=-'],
+                             stdout=subprocess.PIPE, check=True)
+        with tarfile.open(fileobj=io.BytesIO(res.stdout), mode='r:') as tar:
+            self.assertEqual(data, tar.extractfile(longname).read())
+
+    def test_stream(self):
+        """test reading image from stdin and writing image to stdout"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        with open(image, 'wb') as f:
+            subprocess.run([self.program, '-cvf', '-', '-s', '1M'] + testfiles[:-1],
+                           stdout=f, check=True)
+        with open(image, 'rb') as f:
+            data = f.read()
+        self.assertEqual(1024 * 1024, len(data))
+        # update image in a pipe
+        res = subprocess.run([self.program, '-rf', '-', testfiles[-1]], input=data,
+                             stdout=subprocess.PIPE, check=True)
+        self.assertEqual(len(data), len(res.stdout))
+        self.workdir = self.tmpdir + '/test_stream'
+        os.makedirs(self.workdir)
+        subprocess.run([self.program, '-xf', '-', '-C', self.workdir], input=res.stdout,
+                       check=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def create_compressed(self, image, size):
+        """create compressed image, skip test if format is not supported"""
+        res = subprocess.run([self.program, '-cf', image, '-s', size] + self.testfiles[:-1],
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        if b'not supported in this build' in res.stderr:
+            self.skipTest(res.stderr.decode().strip())
+        self.assertEqual(0, res.returncode, res.stderr.decode())
+
+    def extract_compressed(self, image, subdir):
+        self.workdir = self.tmpdir + '/' + subdir
+        os.makedirs(self.workdir)
+        output, res = self.run_test(['-xf', image, '-C', self.workdir])
+        for fname in self.testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_compressed(self):
+        """test creating and updating gzip compressed image"""
+        image = self.tmpdir + '/lfs.img.gz'
+        self.create_compressed(image, '4M')
+        output, res = self.run_test(['-rf', image, self.testfiles[-1]])
+        with open(image, 'rb') as f:
+            self.assertEqual(b'\x1f\x8b', f.read(2))
+        with gzip.open(image, 'rb') as f:
+            self.assertEqual(4 * 1024 * 1024, len(f.read()))
+        self.extract_compressed(image, 'test_compressed')
+
+    def test_compressed_zstd(self):
+        """test creating and updating zstd compressed image"""
+        image = self.tmpdir + '/lfs.img.zst'
+        self.create_compressed(image, '32M')
+        output, res = self.run_test(['-rf', image, self.testfiles[-1]])
+        with open(image, 'rb') as f:
+            self.assertEqual(b'\x28\xb5\x2f\xfd', f.read(4))
+        self.extract_compressed(image, 'test_compressed_zstd')
+        zstd = shutil.which('zstd')
+        if not zstd:
+            return
+        # streamed frame (no content size) is decompressed serially
+        data = subprocess.run([zstd, '-dc', image], stdout=subprocess.PIPE,
+                              check=True).stdout
+        self.assertEqual(32 * 1024 * 1024, len(data))
+        stream = subprocess.run([zstd, '-c'], input=data, stdout=subprocess.PIPE,
+                                check=True).stdout
+        image = self.tmpdir + '/stream.img.zst'
+        with open(image, 'wb') as f:
+            f.write(stream)
+        self.extract_compressed(image, 'test_compressed_stream')
+
+    def test_compressed_directory(self):
+        """test updating compressed image given with relative path and -C"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img.gz'
+        output, res = self.run_test(['-cf', image, '-s', '1M'] + testfiles[:1])
+        self.workdir = self.tmpdir + '/files'
+        os.makedirs(self.workdir)
+        shutil.copy(testfiles[-1], self.workdir)
+        output, res = self.run_test(['-rf', os.path.relpath(image), '-C', self.workdir,
+                                     testfiles[-1]])
+        self.assertEqual([testfiles[-1]], os.listdir(self.workdir))
+        with gzip.open(image, 'rb') as f:
+            data = f.read()
+        with open(self.tmpdir + '/lfs.img', 'wb') as f:
+            f.write(data)
+        output, res = self.run_test(['-tf', self.tmpdir + '/lfs.img'])
+        for fname in [testfiles[0], testfiles[-1]]:
+            self.assertIn(fname, output)
+
+    def test_serve(self):
+        """test serving image over unix domain socket"""
+        image = self.tmpdir + '/lfs.img'
+        sock_path = self.tmpdir + '/lfst.sock'
+        output, res = self.run_test(['-cf', image, '-s', '1M'] + self.testfiles[:1])
+        server = subprocess.Popen([self.program, '--serve=' + sock_path, '-f', image])
+        try:
+            for i in range(100):
+                if os.path.exists(sock_path):
+                    break
+                time.sleep(0.05)
+            # client that sends partial request must not block other clients
+            stalled = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            stalled.connect(sock_path)
+            stalled.sendall(struct.pack('<IBBHI', 0x5653464c, 3, 0, 1, 100) + b'x')
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.settimeout(10)
+            sock.connect(sock_path)
+
+            def request(op, path, data=b''):
+                path = path.encode()
+                sock.sendall(struct.pack('<IBBHI', 0x5653464c, op, 0, len(path), len(data))
+                             + path + data)
+                resp = sock.recv(8, socket.MSG_WAITALL)
+                status, length = struct.unpack('<iI', resp)
+                return status, (sock.recv(length, socket.MSG_WAITALL) if length else b'')
+
+            self.assertEqual((0, b''), request(3, 'dir/new.txt', b'hello'))
+            self.assertEqual((0, b'hello'), request(2, 'dir/new.txt'))
+            status, data = request(1, '/')
+            self.assertEqual(0, status)
+            self.assertIn(b'dir', data)
+            self.assertIn(self.testfiles[0].encode(), data)
+            self.assertEqual(0, request(4, self.testfiles[0])[0])
+            self.assertEqual(-2, request(2, 'missing')[0])
+            self.assertEqual(0, request(6, '')[0])
+            sock.close()
+            stalled.close()
+            self.assertEqual(0, server.wait(timeout=10))
+        finally:
+            if server.poll() is None:
+                server.kill()
+        output, res = self.run_test(['-tf', image])
+        self.assertRegex(output, r'dir/new.txt\n')
+        self.assertNotIn(self.testfiles[0], output)
+
+    def test_sync(self):
+        """test mirroring a directory into filesystem image"""
+        image = self.tmpdir + '/lfs.img'
+        srcdir = self.tmpdir + '/src'
+        os.makedirs(srcdir + '/sub')
+        for fname in self.testfiles:
+            shutil.copy(fname, srcdir + '/sub')
+        # initial sync writes all files
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '-C', srcdir, '--sync', '.'])
+        for fname in self.testfiles:
+            self.assertRegex(output, r'sub/' + fname + '\n')
+        # change one file, remove one file
+        with open(srcdir + '/sub/' + self.testfiles[0], 'wb') as f:
+            f.write(b'changed')
+        os.remove(srcdir + '/sub/' + self.testfiles[1])
+        output2, res2 = self.run_test(['-rvf', image, '-C', srcdir, '--sync', '.'])
+        self.assertRegex(output2, r'sub/' + self.testfiles[0] + '\n')
+        self.assertRegex(output2, r'sub/' + self.testfiles[1] + r' \(deleted\)\n')
+        for fname in self.testfiles[2:]:
+            self.assertRegex(output2, r'sub/' + fname + r' \(unchanged\)\n')
+        output3, res3 = self.run_test(['-tvf', image])
+        self.assertRegex(output3, r'\s7 0000-00-00 00:00 \./sub/' + self.testfiles[0] + '\n')
+        self.assertNotRegex(output3, r'\./sub/' + self.testfiles[1] + '\n')
+
+    def test_sync_after_update(self):
+        """test sync after file was replaced without sync"""
+        image = self.tmpdir + '/lfs.img'
+        srcdir = self.tmpdir + '/src'
+        otherdir = self.tmpdir + '/other'
+        os.makedirs(srcdir)
+        os.makedirs(otherdir)
+        with open(srcdir + '/file.txt', 'wb') as f:
+            f.write(b'original')
+        with open(otherdir + '/file.txt', 'wb') as f:
+            f.write(b'modified')
+        output, res = self.run_test(['-cf', image, '-s', '1M', '-C', srcdir, '--sync', '.'])
+        # replace content (with same size) without --sync
+        output, res = self.run_test(['-rf', image, '-C', otherdir, 'file.txt'])
+        output, res = self.run_test(['-rvf', image, '-C', srcdir, '--sync', '.'])
+        self.assertNotIn('(unchanged)', output)
+        output, res = self.run_test(['-xf', image], directory=True)
+        with open(self.workdir + '/file.txt', 'rb') as f:
+            self.assertEqual(b'original', f.read())
+
+    def test_create_auto_size(self):
+        """test creating minimal size image"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-cvf', image, '-s', 'auto,headroom=8K'] + testfiles)
+        size = os.path.getsize(image)
+        self.assertEqual(0, size % 4096)
+        self.assertLess(size, 64 * 1024)
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+        # image size limit
+        output3, res3 = self.run_test(['-cvf', image, '-O', '-s', 'auto,max=32K']
+                                      + testfiles, check=False)
+        self.assertEqual(1, res3)
+
+    def test_create_auto_size_nested(self):
+        """test creating minimal size image with deeply nested files"""
+        image = self.tmpdir + '/lfs.img'
+        srcdir = self.tmpdir + '/src'
+        nested = '/'.join('d%d' % i for i in range(12))
+        os.makedirs(srcdir + '/' + nested)
+        shutil.copy(self.testfiles[0], srcdir + '/' + nested)
+        output, res = self.run_test(['-cf', image, '-s', 'auto', '-C', srcdir,
+                                     nested + '/' + self.testfiles[0]])
+        output2, res2 = self.run_test(['-xf', image], directory=True)
+        self.assertEqual(self.get_hash(self.testfiles[0]),
+                         self.get_hash(nested + '/' + self.testfiles[0], tmpdir=True))
+
+    def test_finalize(self):
+        """test finalizing filesystem image"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '--finalize'] + testfiles)
+        self.assertRegex(output, r'Metadata read at mount:\s+\d+ bytes')
+        output2, res2 = self.run_test(['-tvf', image])
+        for fname in testfiles:
+            self.assertRegex(output2, r'\s\./' + fname + '\n')
+
+    def test_create_contiguous(self):
+        """test creating image with contiguous files"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '--contiguous', 'test4*',
+                                     '--contiguous', '*5.bin'] + testfiles)
+        self.assertRegex(output, r'test5.bin: blocks \d+-\d+, flash offset 0x[0-9a-f]+ - '
+                         r'0x[0-9a-f]+\n')
+        self.assertNotRegex(output, r'not contiguous')
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+
+    def test_extent_index(self):
+        """test writing file extent index"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        index = self.tmpdir + '/lfs.idx'
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '--index', index,
+                                     '--index-pattern', '*.bin'] + testfiles)
+        with open(index, 'rb') as f:
+            data = f.read()
+        with open(image, 'rb') as f:
+            img = f.read()
+        crc = struct.unpack_from('<I', data, len(data) - 4)[0]
+        self.assertEqual(zlib.crc32(data[:-4]) ^ 0xffffffff, crc)
+        magic, version, hsize, bsize, bcount, base, count, size = \
+            struct.unpack_from('<4sHHIIQII', data, 0)
+        self.assertEqual(b'LFSX', magic)
+        self.assertEqual(len(testfiles), count)
+        self.assertEqual(len(data), size)
+        pos = hsize
+        for fname in testfiles:
+            plen, flags, fsize, ecount = struct.unpack_from('<HHII', data, pos)
+            pos += 12
+            path = data[pos:pos + plen].decode()
+            pos += (plen + 3) & ~3
+            self.assertEqual(fname, path)
+            content = b''
+            for _ in range(ecount):
+                block, off, esize = struct.unpack_from('<III', data, pos)
+                pos += 12
+                content += img[block * bsize + off:block * bsize + off + esize]
+            if not flags:
+                with open(fname, 'rb') as f:
+                    self.assertEqual(f.read(), content)
+
+    def test_delta(self):
+        """test creating and applying block level delta"""
+        testfiles = self.testfiles
+        old_image = self.tmpdir + '/old.img'
+        new_image = self.tmpdir + '/new.img'
+        patch = self.tmpdir + '/lfs.patch'
+        output, res = self.run_test(['-cf', old_image, '-s', '1M'] + testfiles[:-1])
+        shutil.copyfile(old_image, new_image)
+        output, res = self.run_test(['-rf', new_image, testfiles[-1]])
+        output, res = self.run_test(['--delta', '-vf', patch, old_image, new_image])
+        self.assertRegex(output, r'\d+ blocks changed')
+        self.assertLess(os.path.getsize(patch), os.path.getsize(new_image))
+        # apply patch to the old image
+        output, res = self.run_test(['--apply-delta', '-vf', old_image, patch])
+        self.assertEqual(self.get_hash(new_image), self.get_hash(old_image))
+        # patch should not apply to a different image
+        with open(old_image, 'r+b') as f:
+            f.write(b'\x55' * 16)
+        output, res = self.run_test(['--apply-delta', '-f', old_image, patch], check=False)
+        self.assertEqual(1, res)
+        self.assertRegex(output, r'does not match')
+
+    def test_changeset(self):
+        """test creating file level changeset"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        changeset = self.tmpdir + '/lfs.lfsc'
+        newdir = self.tmpdir + '/new'
+        output, res = self.run_test(['-cf', image, '-s', '1M'] + testfiles[:3])
+        os.makedirs(newdir + '/sub')
+        shutil.copyfile(testfiles[1], newdir + '/' + testfiles[1])
+        shutil.copyfile(testfiles[0], newdir + '/' + testfiles[2])
+        shutil.copyfile(testfiles[3], newdir + '/sub/' + testfiles[3])
+        output, res = self.run_test(['--changeset', changeset, '-vf', image, newdir])
+        with open(changeset, 'rb') as f:
+            data = f.read()
+        magic, version, hsize, count = struct.unpack_from('<4sHHI', data, 0)
+        self.assertEqual(b'LFSC', magic)
+        pos = hsize
+        ops = []
+        while True:
+            op, plen, dsize, crc = struct.unpack_from('<BxHII', data, pos)
+            if op == 0:
+                self.assertEqual(zlib.crc32(data[:pos]) ^ 0xffffffff, crc)
+                break
+            path = data[pos + 12:pos + 12 + plen]
+            payload = data[pos + 12 + plen:pos + 12 + plen + dsize]
+            self.assertEqual(zlib.crc32(path + payload) ^ 0xffffffff, crc)
+            ops.append((op, path.decode()))
+            pos += 12 + plen + dsize
+        self.assertEqual(count, len(ops))
+        self.assertEqual([(3, '/' + testfiles[0]), (4, '/sub'),
+                          (1, '/sub/' + testfiles[3]), (2, '/' + testfiles[2])], ops)
+
+    def test_personalize(self):
+        """test creating personalized copies of an image"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        manifest = self.tmpdir + '/units.txt'
+        units = []
+        for i in range(4):
+            unitdir = f'{self.tmpdir}/unit{i}'
+            os.makedirs(unitdir + '/certs')
+            with open(unitdir + '/serial.txt', 'w') as f:
+                f.write(f'serial-{i}\n')
+            shutil.copyfile(testfiles[i], unitdir + '/certs/cert.bin')
+            units.append((f'{self.tmpdir}/unit{i}.img', unitdir))
+        with open(manifest, 'w') as f:
+            f.write('# per-unit images\n')
+            for unit in units:
+                f.write(f'{unit[0]} {unit[1]}\n')
+        output, res = self.run_test(['-cf', image, '-s', '1M',
+                                     '--personalize', manifest] + testfiles)
+        base_hash = self.get_hash(image)
+        for i, unit in enumerate(units):
+            self.assertEqual(os.path.getsize(image), os.path.getsize(unit[0]))
+            extractdir = f'{self.tmpdir}/extract{i}'
+            os.makedirs(extractdir)
+            output, res = self.run_test(['-xf', unit[0], '-C', extractdir])
+            self.assertEqual(self.get_hash(testfiles[-1]),
+                             self.get_hash(extractdir + '/' + testfiles[-1]))
+            self.assertEqual(self.get_hash(testfiles[i]),
+                             self.get_hash(extractdir + '/certs/cert.bin'))
+            with open(extractdir + '/serial.txt') as f:
+                self.assertEqual(f'serial-{i}\n', f.read())
+        # base image must not be modified
+        self.assertEqual(base_hash, self.get_hash(image))
+
+    def test_personalize_relative(self):
+        """test personalized copies with relative paths and -C"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        manifest = self.tmpdir + '/units.txt'
+        srcdir = self.tmpdir + '/src'
+        unitdir = self.tmpdir + '/unit0'
+        unit_image = self.tmpdir + '/unit0.img'
+        os.makedirs(srcdir)
+        os.makedirs(unitdir)
+        shutil.copy(testfiles[0], srcdir)
+        shutil.copyfile(testfiles[1], unitdir + '/cert.bin')
+        # paths in manifest are relative to current directory (not to -C)
+        with open(manifest, 'w') as f:
+            f.write(f'{os.path.relpath(unit_image)} {os.path.relpath(unitdir)}\n')
+        output, res = self.run_test(['-cf', os.path.relpath(image), '-s', '1M',
+                                     '--personalize', os.path.relpath(manifest),
+                                     '-C', srcdir, testfiles[0]])
+        self.assertEqual(['cert.bin'], os.listdir(unitdir))
+        self.workdir = self.tmpdir + '/extract'
+        os.makedirs(self.workdir)
+        output, res = self.run_test(['-xf', unit_image, '-C', self.workdir])
+        self.assertEqual(self.get_hash(testfiles[0]),
+                         self.get_hash(self.workdir + '/' + testfiles[0]))
+        self.assertEqual(self.get_hash(testfiles[1]),
+                         self.get_hash(self.workdir + '/cert.bin'))
+
+    def test_store(self):
+        """test storing images into block store and reconstructing them"""
+        testfiles = self.testfiles
+        image1 = self.tmpdir + '/lfs1.img'
+        image2 = self.tmpdir + '/lfs2.img'
+        store = self.tmpdir + '/store'
+        output, res = self.run_test(['-cf', image1, '-s', '1M'] + testfiles[:-1])
+        shutil.copyfile(image1, image2)
+        output, res = self.run_test(['-rf', image2, testfiles[-1]])
+        output, res = self.run_test(['--store', store, '-vf', image1])
+        self.assertRegex(output, r'lfs1.img: 256 blocks')
+        output, res = self.run_test(['--store', store, '-vf', image2, 'second'])
+        # most blocks of the second image should already be in the store
+        new_blocks = int(re.search(r'\((\d+) new', output).group(1))
+        self.assertLess(new_blocks, 10)
+        for name, orig in (('lfs1.img', image1), ('second', image2)):
+            restored = self.tmpdir + '/restored.img'
+            output, res = self.run_test(['--materialize', store, '-Of', restored, name])
+            self.assertEqual(self.get_hash(orig), self.get_hash(restored))
+
     def test_delete(self):
         """test deleting files from filesystem image"""
         testfiles = self.testfiles
@@ -160,6 +873,108 @@ class LFSTests(unittest.TestCase):
         for fname in self.testfiles:
             self.assertRegex(output2, r'\s\./' + fname + '\n')
 
+    def test_scan(self):
+        """test scanning for filesystems and automatic offset"""
+        output, res = self.run_test(['--scan', '-f', 'lfs_offset_64K.img'])
+        self.assertEqual(['0x00010000: LittleFS v2.1, block size 4096, '
+                          'block count 16 (65536 bytes)'], output.splitlines())
+        output, res = self.run_test(['--scan', '-f', 'lfs_512.img'])
+        self.assertRegex(output, r'^0x00000000: .*block size 512, block count 128')
+        output, res = self.run_test(['-tvf', 'lfs_offset_64K.img', '-o', 'auto'])
+        for fname in self.testfiles:
+            self.assertRegex(output, r'\s\./' + fname + '\n')
+
+    def test_partition(self):
+        """test processing multiple filesystems in one image"""
+        image = self.tmpdir + '/flash.img'
+        with open(image, 'wb') as f:
+            for name in ('lfs_4096.img', 'lfs_offset_64K.img'):
+                with open(name, 'rb') as img:
+                    f.write(img.read())
+        # second filesystem is at 64K offset inside lfs_offset_64K.img
+        output, res = self.run_test(['-tvf', image, '--partition', '0:64K',
+                                     '--partition', '0x20000:64K'])
+        self.assertRegex(output, r'Partition 0x00000000:')
+        self.assertRegex(output, r'Partition 0x00020000:')
+        with open(image, 'rb') as f:
+            before = f.read()
+        # only modified partition should have been written back
+        output, res = self.run_test(['-rf', image, '--partition', '0:64K',
+                                     '--partition', '0x20000:64K', '-O', 'test1.bin'])
+        with open(image, 'rb') as f:
+            after = f.read()
+        self.assertEqual(len(before), len(after))
+        self.assertNotEqual(before, after)
+        output, res = self.run_test(['-rf', image, '--partition', '0x20000:64K',
+                                     '-O', 'test2.bin'])
+        with open(image, 'rb') as f:
+            after2 = f.read()
+        self.assertEqual(after[:0x20000], after2[:0x20000])
+        self.assertNotEqual(after[0x20000:0x30000], after2[0x20000:0x30000])
+        output, res = self.run_test(['-tvf', image, '-o', 'auto', 'test1.bin'])
+        self.assertEqual(2, len(re.findall(r'\s\./test1.bin\n', output)))
+
+    def test_partition_block_size(self):
+        """test partitions with different blocksizes"""
+        image = self.tmpdir + '/flash.img'
+        with open(image, 'wb') as f:
+            for name in ('lfs_512.img', 'lfs_4096.img'):
+                with open(name, 'rb') as img:
+                    f.write(img.read())
+        output, res = self.run_test(['-tvf', image, '--partition', '0:64K',
+                                     '--partition', '64K:64K'])
+        # blocksize detected for first partition must not carry over
+        self.assertRegex(output, r'blocksize is 512 \(and not 4096\)')
+        self.assertNotRegex(output, r'blocksize is 4096')
+        self.assertEqual(2, len(re.findall(r'\s\./' + self.testfiles[-1] + '\n', output)))
+
+    def test_large_offset(self):
+        """test filesystem beyond 4GB in a (sparse) image file"""
+        image = self.tmpdir + '/emmc.img'
+        offset = 5 * 1024 * 1024 * 1024
+        with open(image, 'wb') as f:
+            f.truncate(offset + 2 * 65536)
+            f.seek(offset)
+            with open('lfs_4096.img', 'rb') as img:
+                f.write(img.read())
+        output, res = self.run_test(['-tvf', image, '-o', '5G'])
+        for fname in self.testfiles:
+            self.assertRegex(output, r'\s\./' + fname + '\n')
+        # update in memory and directly, and check both changes are visible
+        shutil.copyfile(self.testfiles[0], self.tmpdir + '/new1.bin')
+        shutil.copyfile(self.testfiles[1], self.tmpdir + '/new2.bin')
+        output, res = self.run_test(['-rf', image, '-o', hex(offset),
+                                     '-C', self.tmpdir, 'new1.bin'])
+        output, res = self.run_test(['-rf', image, '-o', '5G', '--direct',
+                                     '-C', self.tmpdir, 'new2.bin'])
+        output, res = self.run_test(['-tvf', image, '-o', '5G'])
+        self.assertRegex(output, r'\s\./new1.bin\n')
+        self.assertRegex(output, r'\s\./new2.bin\n')
+        with open(image, 'rb') as f:
+            self.assertEqual(bytes(65536), f.read(65536))
+
+    def test_max_memory(self):
+        """test loading image on demand with limited memory"""
+        testfiles = self.testfiles
+        image = self.tmpdir + '/lfs.img'
+        output, res = self.run_test(['-tvf', 'lfs_4096.img'])
+        output2, res2 = self.run_test(['-tvf', 'lfs_4096.img', '--max-memory', '8K'])
+        self.assertEqual(output, output2)
+        # blocks are evicted (and written back) while creating the image
+        output, res = self.run_test(['-cvf', image, '-s', '1M', '--max-memory', '16K']
+                                    + testfiles)
+        output2, res2 = self.run_test(['-xvf', image], directory=True)
+        for fname in testfiles:
+            self.assertRegex(output2, r'\./' + fname + '\n')
+            self.assertEqual(self.get_hash(fname, tmpdir=False),
+                             self.get_hash(fname, tmpdir=True))
+        # huge pages are only used for the --max-memory block cache
+        output, res = self.run_test(['-tvf', 'lfs_4096.img', '--huge-pages'], check=False)
+        self.assertEqual(1, res)
+        self.assertRegex(output, r'--huge-pages can only be used with --max-memory')
+        output, res = self.run_test(['-tvf', 'lfs_4096.img', '--max-memory', '8K',
+                                     '--huge-pages'])
+
 
 
 if __name__ == '__main__':